@@ -0,0 +1,449 @@
+/**
+ * Command protocol routines
+ *
+ * The Command protocol carries commands from the PC to the monitoring boards,
+ * the opposite direction of the Communication protocol. Commands arrive on
+ * UART 0 and are relayed to the next board in the daisy-chain on UART 1.
+ *
+ * A command frame on the wire consists of:
+ * - a frame start byte 1AAALLLL: AAA is the destination address, LLLL the
+ *   number of databytes (0-15)
+ * - the databytes, all with the MSB cleared. The first one is the command
+ *   number.
+ * - a check byte: the XOR of the frame start byte and the databytes, MSB
+ *   cleared.
+ *
+ * The address counts the boards between the PC and the destination: address 0
+ * is the board receiving the frame. A board relays frames with a non-zero
+ * address, decreasing the address. Address 7 means all boards, and is relayed
+ * unchanged.
+ *
+ * The interrupt handler only stores and relays bytes; checking and executing
+ * commands is done from the main loop by cmd_receive(). When no commands are
+ * sent, none of this code runs except for the buffer check in cmd_receive().
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "global.h"
+#include "uart.h"
+#include "comm_proto.h"
+#include "cmd_proto.h"
+#include "slots.h"
+#include "ring.h"
+
+/**
+ * Maximum number of databytes in a command frame
+ */
+#define CMD_MAX_SIZE 15
+
+/**
+ * The destination address meaning "all boards"
+ */
+#define CMD_BROADCAST 7
+
+/**
+ * Circular buffer holding received command frames
+ *
+ * Frames are stored as received, including frame start byte and check byte.
+ * The head is only advanced when a frame is complete, so cmd_receive() never
+ * sees a partial frame.
+ */
+static RING(UART0_RX_BUFSIZE) uart0_rx_buffer;
+
+/**
+ * Circular buffer holding command frames to relay to the daisy-chain
+ */
+static RING(UART1_TX_BUFSIZE) uart1_tx_buffer;
+
+// Reception state, only used by the interrupt handler
+static uint8_t recv_remaining; // Bytes left in current frame, 0: between frames
+static uint8_t recv_write_pos; // Next position to write in uart0_rx_buffer
+static uint8_t recv_local; // Non-zero when current frame is stored for us
+static uint8_t recv_relay; // Non-zero when current frame is relayed
+static uint8_t recv_relay_fix; // Correction for the check byte of relayed frame
+
+// Statistics
+static volatile uint8_t stat_line_errors; // Framing and hardware overflow errors
+static volatile uint8_t stat_drops; // Frames dropped because a buffer was full
+static uint8_t stat_check_errors; // Frames with a wrong check byte
+static uint8_t stat_commands; // Commands executed
+
+/**
+ * Default command handler
+ *
+ * This is a weakly bound symbol; you can override it with a monitor_command()
+ * function of your own.
+ *
+ * Knows no commands.
+ */
+uint8_t monitor_command (const uint8_t cmd[], const uint8_t len) __attribute__ ((weak));
+uint8_t monitor_command (const uint8_t cmd[], const uint8_t len) {
+  return CMD_UNKNOWN;
+}
+
+#ifdef RING_HWM
+/**
+ * Default high-water mark of the monitor
+ *
+ * This is a weakly bound symbol; you can override it with a monitor_hwm()
+ * function of your own.
+ */
+uint8_t monitor_hwm () __attribute__ ((weak));
+uint8_t monitor_hwm () {
+  return 0;
+}
+#endif
+
+/**
+ * Append a byte to the relay buffer and start transmission.
+ *
+ * Precondition: room in the buffer has been checked with ring_free().
+ */
+static inline void relay_put (const uint8_t) __attribute__ ((always_inline));
+static inline void relay_put (const uint8_t c) {
+  ring_push (uart1_tx_buffer, c);
+
+  // Enable transmit interrupt
+  UCSR1B |= _BV(UDRIE1);
+}
+
+/**
+ * Inline function doing the actual work for the command reception interrupt
+ * handler below.
+ *
+ * A frame is only relayed if it fits in the relay buffer completely, so the
+ * downstream board never gets a frame cut short by a full buffer. A frame cut
+ * short by a reception error is relayed as far as it got; the receiver will
+ * detect that by the frame start byte of the next frame.
+ *
+ * status: contents of UCSR0A belonging to the received byte
+ * recv: the received byte
+ */
+static inline void cmd_recv (const uint8_t, uint8_t) __attribute__ ((always_inline));
+static inline void cmd_recv (const uint8_t status, uint8_t recv) {
+  uint8_t addr, relay_start;
+
+  if (status & (_BV(FE0) | _BV(DOR0))) {
+    // Reception error; drop current frame
+    stat_line_errors++;
+    recv_remaining = 0;
+
+    if (status & _BV(FE0)) {
+      // The received byte is garbage
+      return;
+    }
+    // On a hardware overflow, the received byte itself is fine
+  }
+
+  if (recv & (1 << 7)) {
+    // Frame start byte
+
+    if (recv_remaining) {
+      // Previous frame was cut short
+      stat_line_errors++;
+    }
+
+    addr = (recv >> 4) & 7;
+    recv_remaining = (recv & 15) + 1; // Databytes and check byte
+
+    recv_local = (addr == 0 || addr == CMD_BROADCAST);
+    if (recv_local) {
+      // Start the frame at the head of the buffer. The head is guaranteed to be
+      // available, since it is never advanced onto the tail.
+      recv_write_pos = uart0_rx_buffer.head;
+      uart0_rx_buffer.buf[recv_write_pos] = recv;
+      recv_write_pos = ring_next (uart0_rx_buffer, recv_write_pos);
+    }
+
+    recv_relay = 0;
+    if (addr != 0) {
+      if (ring_free (uart1_tx_buffer) > recv_remaining) {
+        // There's room for the complete frame
+        if (addr == CMD_BROADCAST) {
+          relay_start = recv;
+        } else {
+          relay_start = recv - (1 << 4);
+        }
+        recv_relay_fix = recv ^ relay_start;
+        recv_relay = 1;
+        relay_put (relay_start);
+      } else {
+        stat_drops++;
+      }
+    }
+    return;
+  }
+
+  if (!recv_remaining) {
+    // Databyte outside a frame; skip it
+    return;
+  }
+
+  recv_remaining--;
+
+  if (recv_local) {
+    if (recv_write_pos == uart0_rx_buffer.tail) {
+      // Buffer full, drop frame
+      stat_drops++;
+      recv_local = 0;
+    } else {
+      uart0_rx_buffer.buf[recv_write_pos] = recv;
+      recv_write_pos = ring_next (uart0_rx_buffer, recv_write_pos);
+    }
+
+    if (recv_local && !recv_remaining) {
+      // Frame complete. It can only be pushed out when that doesn't make the
+      // buffer look empty.
+      if (recv_write_pos == uart0_rx_buffer.tail) {
+        stat_drops++;
+      } else {
+        ring_commit (uart0_rx_buffer, recv_write_pos);
+      }
+    }
+  }
+
+  if (recv_relay) {
+    if (!recv_remaining) {
+      // The check byte; the address in the frame start byte was changed
+      recv ^= recv_relay_fix;
+    }
+    relay_put (recv);
+  }
+}
+
+/**
+ * This interrupt routine gets called when a byte has been received on UART 0,
+ * the UART connecting to the PC or the previous board in the daisy-chain.
+ *
+ * It runs with interrupts disabled; it only does a handful of comparisons and
+ * buffer writes per byte.
+ */
+ISR(USART0_RXC_vect) {
+  uint8_t status;
+
+  // Status flags first; they belong to the byte at the front of the FIFO
+  status = UCSR0A;
+  cmd_recv (status, UDR0);
+}
+
+/**
+ * Interrupt handler for relaying commands through UART 1 (UDR empty interrupt)
+ *
+ * This handler should only be active when there is data in the buffer, so we
+ * don't test that.
+ */
+ISR(USART1_UDRE_vect) {
+  uint8_t temp_tail;
+
+  temp_tail = uart1_tx_buffer.tail;
+  UDR1 = uart1_tx_buffer.buf[temp_tail]; // Get byte from buffer
+  temp_tail = ring_next (uart1_tx_buffer, temp_tail); // Increase pointer
+
+  if (temp_tail == uart1_tx_buffer.head) {
+    // Buffer empty, disable this interrupt
+    UCSR1B &= ~(_BV(UDRIE1));
+  }
+  uart1_tx_buffer.tail = temp_tail;
+}
+
+/**
+ * Send a command frame of our own to the next board in the daisy-chain
+ *
+ * The frame is only inserted between relayed frames, and only when it fits in
+ * the relay buffer completely.
+ */
+uint8_t cmd_send_downstream (const uint8_t cmd[], const uint8_t len) {
+  uint8_t i, check, queued;
+
+  check = (1 << 7) | len; // Frame start byte: address 0
+  queued = 0;
+
+  cli(); // Start of critical section; the reception interrupt relays too
+  if (!(recv_relay && recv_remaining) && ring_free (uart1_tx_buffer) > len + 1) {
+    relay_put (check);
+    for (i = 0; i < len; i++) {
+      relay_put (cmd[i]);
+      check ^= cmd[i];
+    }
+    relay_put (check & 127);
+    queued = 1;
+  }
+  sei(); // End of critical section
+
+  return queued;
+}
+
+/**
+ * Send the statistics of the Command protocol, and with RING_HWM the
+ * high-water marks of all buffers.
+ */
+static void cmd_send_stats () {
+  comm_start_frame (MANAG_PROTO);
+  comm_send_byte (MANAG_STATS);
+  comm_send_byte (MANAG_STATS_CMD);
+  comm_send_byte (stat_commands);
+  comm_send_byte (stat_check_errors);
+  comm_send_byte (stat_line_errors);
+  comm_send_byte (stat_drops);
+  comm_end_frame ();
+
+#ifdef RING_HWM
+  comm_start_frame (MANAG_PROTO);
+  comm_send_byte (MANAG_STATS);
+  comm_send_byte (MANAG_STATS_HWM);
+  comm_send_byte (uart0_tx_hwm ());
+  comm_send_byte (comm_rx_hwm ());
+  comm_send_byte (ring_hwm_take (uart0_rx_buffer));
+  comm_send_byte (ring_hwm_take (uart1_tx_buffer));
+  comm_send_byte (monitor_hwm ());
+  comm_end_frame ();
+#endif
+}
+
+/**
+ * Execute one of the commands common to all boards, or pass it to the
+ * monitor.
+ *
+ * Returns the result code for the "Command acknowledge" message, or
+ * CMD_NO_ACK when the command should not be acknowledged.
+ */
+static uint8_t cmd_execute (const uint8_t cmd[], const uint8_t len) {
+  switch (cmd[0]) {
+    case CMD_PING:
+      return CMD_OK;
+
+    case CMD_IDLE_TIMEOUT:
+      // Argument: timeout in milliseconds, 14 bits, most significant 7 first
+      if (len != 3) {
+        return CMD_BAD_ARGS;
+      }
+      comm_set_idle_timeout (((uint16_t) cmd[1] << 7) | cmd[2]);
+      return CMD_OK;
+
+    case CMD_STATS:
+      if (len != 1) {
+        return CMD_BAD_ARGS;
+      }
+      cmd_send_stats ();
+      return CMD_OK;
+
+    case CMD_LINE_CODING:
+      // Argument: COMM_CODING_*
+      if (len != 2 || cmd[1] > COMM_CODING_AUTO) {
+        return CMD_BAD_ARGS;
+      }
+      comm_set_line_coding (cmd[1]);
+      return CMD_OK;
+
+#ifdef COMM_DICT
+    case CMD_DICT:
+      // Argument: 0: off, 1: on
+      if (len != 2 || cmd[1] > 1) {
+        return CMD_BAD_ARGS;
+      }
+      comm_set_dict (cmd[1]);
+      return CMD_OK;
+#endif
+
+    case CMD_AGGREGATE:
+      // Argument: 0: off, 1: on
+      if (len != 2 || cmd[1] > 1) {
+        return CMD_BAD_ARGS;
+      }
+      comm_set_aggregate (cmd[1]);
+      return CMD_OK;
+
+    case CMD_SLOTS:
+      // Arguments: number of slots (0: off), slot length in ms, our slot
+      // The limits bound the length of a cycle, see MAX_BOARDS in slots.c
+      if (len != 4 || cmd[1] > 8 || !cmd[2] || (cmd[1] && cmd[3] >= cmd[1])
+          || cmd[3] >= 8) {
+        return CMD_BAD_ARGS;
+      }
+      if (!slots_set (cmd[1], cmd[2], cmd[3])) {
+        return CMD_FAILED;
+      }
+      // The schedule is passed on by the boards; only the PC gets an ack
+      return cmd[3] ? CMD_NO_ACK : CMD_OK;
+
+    default:
+      if (cmd[0] < CMD_MONITOR) {
+        return CMD_UNKNOWN;
+      }
+      return monitor_command (cmd, len);
+  }
+}
+
+/**
+ * Execute a received command, if available.
+ *
+ * Only one command is executed per call. The command is checked, executed and
+ * acknowledged to the PC with a "Command acknowledge" management frame.
+ * Commands not common to all boards are passed to monitor_command().
+ *
+ * @returns non-zero when a frame was sent, 0 otherwise.
+ */
+int8_t cmd_receive () {
+  uint8_t cmd[CMD_MAX_SIZE];
+  uint8_t len, i, check, result;
+
+  if (ring_empty (uart0_rx_buffer)) {
+    // No command
+    return 0;
+  }
+
+  // Only complete frames are in the buffer, so no more checks on the head
+  check = ring_pop (uart0_rx_buffer);
+  len = check & 15;
+  ring_pop_n (uart0_rx_buffer, cmd, len);
+  check ^= ring_pop (uart0_rx_buffer);
+
+  for (i = 0; i < len; i++) {
+    check ^= cmd[i];
+  }
+
+  if (check & 127) {
+    // Check byte wrong; the frame start byte leaves the MSB set
+    stat_check_errors++;
+    return 0;
+  }
+
+  if (len == 0) {
+    // No command in the frame
+    return 0;
+  }
+
+  stat_commands++;
+  result = cmd_execute (cmd, len);
+  if (result == CMD_NO_ACK) {
+    return 0;
+  }
+
+  // Acknowledge
+  comm_start_frame (MANAG_PROTO);
+  comm_send_byte (MANAG_CMD_ACK);
+  comm_send_byte (cmd[0]);
+  comm_send_byte (result);
+  comm_end_frame ();
+
+  return 1;
+}
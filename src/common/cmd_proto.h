@@ -0,0 +1,52 @@
+/**
+ * Command protocol header file
+ *
+ * Provides the routines for receiving commands from the PC, and for relaying
+ * them to daisy-chained boards.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_CMD_PROTO_H
+#define FILE_CMD_PROTO_H
+
+#include <stdint.h>
+
+/**
+ * Execute a received command, if available.
+ *
+ * Only one command is executed per call. The command is checked, executed and
+ * acknowledged to the PC with a "Command acknowledge" management frame.
+ * Commands not common to all boards are passed to monitor_command().
+ *
+ * @returns non-zero when a frame was sent, 0 otherwise.
+ */
+extern int8_t cmd_receive ();
+
+/**
+ * Send a command frame of our own to the next board in the daisy-chain
+ *
+ * The frame gets address 0, so the next board executes it. It is inserted
+ * between the frames relayed from the PC.
+ *
+ * Returns non-zero when the frame was queued, 0 when the relay buffer had no
+ * room or a frame was being relayed.
+ */
+extern uint8_t cmd_send_downstream (const uint8_t cmd[], const uint8_t len);
+
+#endif // ndef FILE_CMD_PROTO_H
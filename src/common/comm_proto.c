@@ -28,10 +28,120 @@
 #include "uart.h"
 #include "timer.h"
 #include "comm_proto.h"
+#include "ring.h"
 
 // Transmission variables
 static uint8_t hi_bits; // most signnificant bits of sent bytes
 static uint8_t parity; // Parity byte to be sent at end of packet (MSB is a don't-care)
+static uint8_t line_coding; // Selected line coding, COMM_CODING_*
+static uint8_t frame_coding; // Line coding of the current frame
+
+/**
+ * Escape line coding
+ *
+ * Databytes below ESC_LIT are sent as they are. Other databytes are sent as two
+ * bytes:
+ * - ESC_HI, then the byte with the MSB cleared, for bytes 80h-FFh
+ * - ESC_LIT, then 0 or 1, for bytes 7Eh and 7Fh
+ *
+ * The parity byte of an escape coded frame is XORed with ESCAPE_TAG, so the
+ * receiver can tell the line codings apart per frame, and the forwarding
+ * boards don't have to know the line coding at all.
+ */
+#define ESC_LIT 0x7E
+#define ESC_HI 0x7F
+#define ESCAPE_TAG 0x55
+
+#ifdef COMM_DICT
+/**
+ * Dictionary of recently sent frames
+ *
+ * A frame sent by comm_send_frame_dict() is stored in the slot given by its
+ * protocol and the sum of its databytes. When the same frame is sent again
+ * while it is still in its slot, a short reference frame is sent instead. The
+ * PC stores every frame of a protocol using the dictionary the same way, so
+ * it can look up the reference. Since the slot only depends on the frame, a
+ * lost frame only affects a single slot, and the check in the reference
+ * frame tells the PC when its copy of the slot is wrong.
+ *
+ * The dictionary is flushed every DICT_FLUSH_PERIOD and whenever this board
+ * reports an overflow or an error, so the PC copy can't stay wrong for long.
+ * It's empty at start-up, when the Hello is sent.
+ */
+#define DICT_SLOTS 8 // Power of 2
+#define DICT_MAX_DATA 6 // Largest frame stored
+static struct {
+  uint8_t len; // 0: slot empty
+  uint8_t proto;
+  uint8_t data[DICT_MAX_DATA];
+} dict[DICT_SLOTS];
+static uint8_t dict_enabled; // Non-zero when references are sent
+#endif
+
+/**
+ * Containers: aggregation of forwarded frames
+ *
+ * When enabled, comm_forward() packs the complete frames that are already
+ * waiting in the daisy-chain buffer into a single container frame, saving the
+ * frame start, hi-bits and parity bytes of each of them. No frame is ever held
+ * back waiting for more frames to arrive, so the latency added to the first
+ * frame is at most the transmission time of a container of
+ * CONTAINER_MAX_DATA databytes.
+ *
+ * Every subframe starts with a header byte: bit 7 set when a byte with the
+ * protocol follows, bits 6-4 the address, bits 3-0 the number of databytes.
+ * Without the protocol byte, the subframe has the protocol of the previous one.
+ */
+#define CONTAINER_MAX_DATA 16 // Sent with the shortest coding, at most 21 bytes
+#define SUB_PROTO_FOLLOWS (1 << 7)
+static uint8_t aggregate_enabled; // Non-zero when containers are sent
+
+#ifdef LINK_USAGE
+/**
+ * Link usage accounting
+ *
+ * Every frame sent on UART 0 is counted, with it's bytes on the wire, under
+ * it's address and under it's protocol. The subframes of a container count
+ * with their share of the wire bytes of the container's data, in proportion
+ * to their decoded size (header and databytes); the rest of the container
+ * counts as a frame of address 0. Error reports and Idle Frames count as management frames of
+ * address 0.
+ *
+ * The counters are reported and reset every second by comm_usage_report().
+ * At 57600 baud, they can't overflow in that time.
+ */
+struct usage_counter {
+  uint16_t bytes;
+  uint16_t frames;
+};
+static struct usage_counter usage_addr[8], usage_proto[16];
+static uint8_t frame_proto; // Protocol of the current frame
+static uint8_t frame_bytes; // Bytes of the current frame put so far
+static uint8_t usage_reporting; // Non-zero while sending the report
+
+/**
+ * Count a frame in the link usage counters
+ */
+static void usage_count (const uint8_t addr, const uint8_t proto,
+    const uint8_t bytes)
+{
+  usage_addr[addr].bytes += bytes;
+  usage_addr[addr].frames++;
+  usage_proto[proto].bytes += bytes;
+  usage_proto[proto].frames++;
+}
+
+/**
+ * Put a byte of a frame of this board in the transmit buffer, counting it
+ */
+#define frame_put(c) do { \
+  uart0_put (c); \
+  frame_bytes++; \
+} while (0)
+#else
+#define frame_put(c) uart0_put (c)
+#define usage_count(addr, proto, bytes)
+#endif
 
 // Reception variables
 
@@ -40,11 +150,72 @@ static uint8_t parity; // Parity byte to be sent at end of packet (MSB is a don'
  *
  * Frame start bytes are in the range 0x80-0xEF. Instead of a frame start byte,
  * there can be a 1-byte error code in the range 0xF0-0xFF, as defined below.
+ *
+ * With RING_ALIGN256, it's buffer fills the bottom 256 bytes of SRAM, so it's
+ * bytes are indexed without any address arithmetic.
  */
-static struct {
-  volatile uint8_t buf[UART1_RX_BUFSIZE];
-  volatile uint8_t head, tail;
-} uart1_rx_buffer;
+#ifdef RING_ALIGN256
+static RING(UART1_RX_BUFSIZE) uart1_rx_buffer RING_AT_BOTTOM;
+#define chain_at(i) ring_page_at (uart1_rx_buffer, i)
+
+/**
+ * The ring is not in .bss, so it's pointers are cleared here. Runs from the
+ * startup code, like jump_main_loop() in main.c.
+ */
+static void uart1_rx_buffer_clear () __attribute__ ((naked, section (".init7"), used));
+static void uart1_rx_buffer_clear () {
+  ring_clear (uart1_rx_buffer);
+}
+#else
+static RING(UART1_RX_BUFSIZE) uart1_rx_buffer;
+#define chain_at(i) (uart1_rx_buffer.buf[i])
+#endif
+
+/**
+ * Number of bytes in the daisy-chain reception buffer
+ */
+uint8_t comm_rx_used () {
+  return ring_used (uart1_rx_buffer);
+}
+
+#ifdef RING_HWM
+/**
+ * Read and reset the high-water mark of the daisy-chain reception buffer
+ */
+uint8_t comm_rx_hwm () {
+  return ring_hwm_take (uart1_rx_buffer);
+}
+#endif
+
+#ifdef CHAIN_AUTOBAUD
+/**
+ * Bit rate detection of the daisy-chain
+ *
+ * The board behind us may run at another bit rate than UART_BAUD. Received at
+ * the wrong rate, most bytes have framing errors. The reception handler counts
+ * the received bytes and the framing errors, and comm_autobaud() checks them
+ * every 10 ms. When framing errors are frequent, UART 1 is switched to the
+ * next rate of chain_rates[]. When enough bytes arrive without framing errors
+ * after a switch, the rate is locked and reported to the PC.
+ *
+ * Once a rate is locked, with or without a switch, it is kept until reset. A
+ * break or a noisy cable on a working link then can't move it to a wrong rate.
+ *
+ * Commands are relayed through the same UART, so they are relayed at the rate
+ * of the board behind us as well.
+ */
+static const uint16_t chain_rates[] = {96, 192, 384, 576, 1152, 2304}; // In 100 baud
+#define CHAIN_RATES (sizeof (chain_rates) / sizeof (chain_rates[0]))
+#define AUTOBAUD_MIN_ERRORS 3 // Framing errors needed to switch
+#define AUTOBAUD_WINDOW 100 // Checks before the statistics are restarted
+#define AUTOBAUD_LOCK_BYTES 64 // Good bytes needed to lock after a switch
+
+static volatile uint8_t chain_rx_bytes; // Received bytes, saturating
+static volatile uint8_t chain_rx_errors; // Framing errors, saturating
+static uint16_t chain_rate = UART_BAUD / 100; // Current rate, in 100 baud
+static uint8_t chain_hunting; // Non-zero after a switch, until locked
+static uint8_t chain_locked; // Non-zero once a rate is locked
+#endif
 
 /**
  * Variable and bit holding "daisy-chain overflow" flag
@@ -54,6 +225,18 @@ static struct {
 #define CHAIN_OVERFLOW_VAR global_prot_var
 #define CHAIN_OVERFLOW_BIT (1 << 0)
 
+/**
+ * Set the "daisy-chain overflow" flag from the reception routines.
+ *
+ * The bulk of the UART1 reception handler runs with interrupts enabled, so the
+ * read-modify-write on the shared variable needs its own critical section.
+ */
+#define chain_overflow_set() do { \
+  cli(); \
+  CHAIN_OVERFLOW_VAR |= CHAIN_OVERFLOW_BIT; \
+  sei(); \
+} while (0)
+
 /**
  * Error codes passed by the interrupt routine
  * 
@@ -69,18 +252,28 @@ static struct {
 #define RECV_ERR_H_OVERFLOW 0xF5
 
 /**
- * The "real time" we saw UART 0 become idle, or:
- * 0 - UART still active
- * 1 - Already sent an Idle Frame
- *
- * This means that "real" times 0 and 1 are mapped to 255.
+ * State of the Idle Frame management: after a certain idle time of UART 0, an
+ * Idle Frame is sent.
+ */
+static uint8_t idle_state;
+#define IDLE_TX_BUSY 0 // UART still active
+#define IDLE_WAITING 1 // UART idle since idle_since
+#define IDLE_SENT 2 // Already sent an Idle Frame
+
+/**
+ * The "real time" we saw UART 0 become idle
+ */
+static uint32_t idle_since;
+
+/**
+ * The time UART 0 has to be idle before an Idle Frame is sent, in RTC ticks.
  *
- * Only the most significant byte of the 16-bit RTC.
+ * Defaults to 100 ms, can be changed by a command from the PC.
  *
- * Used for Idle Frame management: after a certain idle time, an Idle Frame is
- * sent.
+ * rtc_period() can't be used in an initializer, so the default is computed
+ * the same way by hand: 100 ms of the /1024 prescaled clock.
  */
-static uint8_t last_byte_time; 
+static uint16_t idle_timeout = 100UL * (F_CPU / 1024) / 1000;
 
 /**
  * Initialise idle timer for Idle Frame management
@@ -89,7 +282,7 @@ static uint8_t last_byte_time;
  * of check_idle_timer().
  */
 void comm_start_idle_timer () {
-  last_byte_time = 0;
+  idle_state = IDLE_TX_BUSY;
 }
 
 /**
@@ -103,47 +296,46 @@ void comm_start_idle_timer () {
  * to the UART transmission routines. No data should be sent to the UART after
  * the call to start_idle_timer() !
  */
-void comm_check_idle_timer (const uint16_t now) {
-  uint8_t idle_time;
-  uint8_t now_hi; // High 8-bits of now 
-  uint8_t temp_last;
-
-  now_hi = now >> 8;
-  temp_last = last_byte_time;
-
-  if (temp_last == 0) {
+void comm_check_idle_timer (const uint32_t now) {
+  if (idle_state == IDLE_TX_BUSY) {
     // Last time we checked, the UART was still active
     
     // Check again
-    if (UCSR0A & _BV(TXC0)) {
-      // It's idle now
-      
-      // Save the idle time and return
-      if (now_hi == 0 || now_hi == 1) {
-        // Special values, use 255
-        last_byte_time = 255;
-      } else {
-        last_byte_time = now_hi;
-      }
+    if (uart0_tx_idle()) {
+      // It's idle now, save the idle time
+      idle_since = now;
+      idle_state = IDLE_WAITING;
     }
     return;
-  } else if (temp_last == 1) {
+  } else if (idle_state == IDLE_SENT) {
     // We already sent an idle frame
     return;
   }
 
-  // we use the fact that unsigned integer arithmetic wraps around nicely
-  idle_time = now_hi - temp_last;
-
-  // Did 100 ms already pass?
-  if (idle_time > (rtc_period (100 mseconds) >> 8)) {
+  // Did the timeout already pass? Unsigned arithmetic wraps around nicely.
+  if (now - idle_since > idle_timeout) {
     // Yes, send idle frame
 
     uart0_put (0x80); 
-    // Set last_byte_time to special value 1
-    last_byte_time = 1;
+    usage_count (0, MANAG_PROTO, 1);
+    idle_state = IDLE_SENT;
   }
-  return;
+}
+
+/**
+ * Set the timeout for sending an Idle Frame
+ *
+ * The timeout is given in milliseconds and converted to RTC ticks, clamped to
+ * the 16-bit maximum.
+ */
+void comm_set_idle_timeout (const uint16_t msecs) {
+  uint32_t period;
+
+  period = (uint32_t) msecs * rtc_period (1 seconds) / 1000;
+  if (period > UINT16_MAX) {
+    period = UINT16_MAX;
+  }
+  idle_timeout = period;
 }
 
 /**
@@ -151,15 +343,21 @@ void comm_check_idle_timer (const uint16_t now) {
  * synchronize on the startbit.
  */
 void comm_sync_pause () {
+#ifndef UART0_TX_POLLED
   uint8_t ucsr0b_save; // We need to restore the UDRIE0 bit correctly
+#endif
   uint8_t pause_start; // When the pause started
   uint8_t pause_duration; // How long we've paused so far
   
+#ifndef UART0_TX_POLLED
   // Stop sending new bytes on the UART; save state of UDRIE0 though
   cli(); // Start of critical section
   ucsr0b_save = UCSR0B; // Save state
   UCSR0B &= ~(_BV(UDRIE0)); // Disable transmit interrupt
   sei(); // End of critical section
+#endif
+  // In polled mode, nothing feeds the UART while we are in here, so there is
+  // nothing to stop.
 
   // Wait until the last byte was transmitted completely
   loop_until_bit_is_set (UCSR0A, TXC0);
@@ -185,10 +383,39 @@ void comm_sync_pause () {
     pause_duration = TCNT1L - pause_start;
   } while (pause_duration < rtc_period_least (F_CPU * 9ULL * 1000000ULL / UART_BAUD) + 1);
 
+#ifndef UART0_TX_POLLED
   // Restore state of UDRIE0
   if (ucsr0b_save & _BV(UDRIE0)) {
     UCSR0B |= _BV(UDRIE0);
   }
+#else
+  // Resume feeding the UART
+  uart0_poll();
+#endif
+}
+
+/**
+ * Select the line coding for the frames sent by this board
+ *
+ * Frames forwarded from the daisy-chain keep the line coding they were sent
+ * with.
+ */
+void comm_set_line_coding (const uint8_t coding) {
+  line_coding = coding;
+}
+
+/**
+ * Start a frame with the given line coding.
+ */
+static void start_frame_coded (const uint8_t proto, const uint8_t coding) {
+	parity = (proto & 15) | (1 << 7) ;// Frame start byte: address 0, proto, MSB set
+	uart0_put (parity); 
+	hi_bits = (1 << 7); // The bit is used to see when 7 bytes have been sent
+  frame_coding = coding;
+#ifdef LINK_USAGE
+  frame_proto = proto & 15;
+  frame_bytes = 1;
+#endif
 }
 
 /**
@@ -196,33 +423,53 @@ void comm_sync_pause () {
  *
  * A byte containing address 0, protocol proto and a flag bit indicating frame
  * start is sent, and variables are initialised.
+ *
+ * With COMM_CODING_AUTO, the frame is sent with the 7-in-8 coding, since the
+ * data is not known in advance.
  */
 void comm_start_frame (const uint8_t proto) {
-	parity = (proto & 15) | (1 << 7) ;// Frame start byte: address 0, proto, MSB set
-	uart0_put (parity); 
-	hi_bits = (1 << 7); // The bit is used to see when 7 bytes have been sent
+  start_frame_coded (proto,
+      (line_coding == COMM_CODING_ESCAPE) ? COMM_CODING_ESCAPE : COMM_CODING_HIBITS);
 }
 
 /**
  * Send a byte over the outgoing serial port, stripping and remembering the
  * high bit, and sending the hi_bits when appropriate.
+ *
+ * In escape coded frames, the byte is escaped when needed instead.
  */
 void comm_send_byte (const uint8_t c) {
   uint8_t temp_hi, temp_par;
 
+  if (frame_coding == COMM_CODING_ESCAPE) {
+    if (c & (1 << 7)) {
+      frame_put (ESC_HI);
+      frame_put (c & 127);
+      parity ^= ESC_HI ^ c; // The MSB of the parity is a don't-care
+    } else if (c >= ESC_LIT) {
+      frame_put (ESC_LIT);
+      frame_put (c & 1);
+      parity ^= ESC_LIT ^ (c & 1);
+    } else {
+      frame_put (c);
+      parity ^= c;
+    }
+    return;
+  }
+
   // Put MSB in hi_bits and clear it
   if (c & (1 << 7)) {
     temp_hi = (hi_bits >> 1) | (1 << 7);
   } else {
     temp_hi = (hi_bits >> 1);
   }
-	uart0_put (c & 127); // Send MSB-stripped byte
+	frame_put (c & 127); // Send MSB-stripped byte
 	temp_par = parity ^ c; // XOR parity and sent byte
   
   if (temp_hi & 1) {
     // 7 bytes have been sent, send the full hi_bits byte
     temp_hi >>= 1; // Shift out the bit used to count sent bytes
-    uart0_put (temp_hi); // Send hi_bits
+    frame_put (temp_hi); // Send hi_bits
     temp_par ^= temp_hi; // XOR parity and sent byte
     temp_hi = (1 << 7); // The bit is used to see when 7 bytes have been sent
   }
@@ -231,6 +478,21 @@ void comm_send_byte (const uint8_t c) {
   parity = temp_par;
 }
 
+/**
+ * Count the frame that just ended in the link usage counters
+ *
+ * The report itself is not counted: it would change the counters while they
+ * are being reported.
+ */
+static inline void end_frame_usage () __attribute__ ((always_inline));
+static inline void end_frame_usage () {
+#ifdef LINK_USAGE
+  if (!usage_reporting) {
+    usage_count (0, frame_proto, frame_bytes);
+  }
+#endif
+}
+
 /**
  * End a frame on the outgoing serial port, sending parity information and,
  * if appropriate, remaining hi_bits.
@@ -240,6 +502,13 @@ void comm_end_frame () {
 
   temp_par = parity;
 
+  if (frame_coding == COMM_CODING_ESCAPE) {
+    // Send tagged parity byte
+    frame_put ((temp_par ^ ESCAPE_TAG) & 127);
+    end_frame_usage ();
+    return;
+  }
+
   // Do we still need to send a hi_bits byte?
   if (hi_bits != (1 << 7)) {
     // Yes, there's unsent data in hi_bits
@@ -252,13 +521,211 @@ void comm_end_frame () {
     }
     temp_hi >>= 1; // Shift out the bit used to count sent bytes
 
-    uart0_put (temp_hi); // Send hi_bits
+    frame_put (temp_hi); // Send hi_bits
     temp_par ^= temp_hi; // XOR parity and sent byte
   }
 
   // Send parity byte
-  uart0_put (temp_par & 127); // Bit 7 is meaningless and stripped
+  frame_put (temp_par & 127); // Bit 7 is meaningless and stripped
+  end_frame_usage ();
+}
+
+/**
+ * The number of databytes that need escaping in the escape coding
+ */
+static uint8_t count_escapes (const uint8_t data[], const uint8_t len) {
+  uint8_t i, escapes;
+
+  escapes = 0;
+  for (i = 0; i < len; i++) {
+    if (data[i] >= ESC_LIT) {
+      escapes++;
+    }
+  }
+  return escapes;
+}
+
+/**
+ * Send a complete frame with the given line coding; with COMM_CODING_AUTO, the
+ * line coding giving the shortest frame on the wire is used.
+ */
+static void send_frame_coded (const uint8_t proto, const uint8_t data[],
+    const uint8_t len, uint8_t coding)
+{
+  uint8_t i;
+
+  if (coding == COMM_CODING_AUTO) {
+    // The 7-in-8 coding costs a byte per 7 databytes, the escape coding a byte
+    // per escaped databyte
+    coding = (count_escapes (data, len) < (uint8_t) (len + 6) / 7) ?
+      COMM_CODING_ESCAPE : COMM_CODING_HIBITS;
+  }
+
+  start_frame_coded (proto, coding);
+  for (i = 0; i < len; i++) {
+    comm_send_byte (data[i]);
+  }
+  comm_end_frame ();
+}
+
+/**
+ * Send a complete frame of len databytes with protocol proto.
+ *
+ * With COMM_CODING_AUTO, the line coding giving the shortest frame on the wire
+ * is used.
+ */
+void comm_send_frame (const uint8_t proto, const uint8_t data[],
+    const uint8_t len)
+{
+  send_frame_coded (proto, data, len, line_coding);
+}
+
+/**
+ * Send a complete frame that is already in wire form
+ */
+void comm_send_wire (const uint8_t frame[], const uint8_t len) {
+  uart0_write (frame, len);
+  usage_count (0, frame[0] & 15, len);
+}
+
+#ifdef COMM_DICT
+/**
+ * Enable or disable references to the dictionary of recently sent frames
+ */
+void comm_set_dict (const uint8_t on) {
+  comm_dict_flush ();
+  dict_enabled = on;
+}
+
+/**
+ * Empty the dictionary of recently sent frames
+ */
+int8_t comm_dict_flush () {
+  uint8_t i;
+
+  for (i = 0; i < DICT_SLOTS; i++) {
+    dict[i].len = 0;
+  }
+  return 0;
+}
+
+/**
+ * Send a complete frame like comm_send_frame(), or a reference to it when it
+ * is in the dictionary of recently sent frames.
+ *
+ * The slot and the check are computed from the Fletcher sums of the data:
+ * s1 is the sum of the databytes, s2 the sum of the successive values of s1.
+ */
+void comm_send_frame_dict (const uint8_t proto, const uint8_t data[],
+    const uint8_t len)
+{
+  uint8_t i, s1, s2, slot, hit;
+
+  if (!dict_enabled || len == 0 || len > DICT_MAX_DATA) {
+    comm_send_frame (proto, data, len);
+    return;
+  }
+
+  s1 = s2 = 0;
+  for (i = 0; i < len; i++) {
+    s1 += data[i];
+    s2 += s1;
+  }
+  slot = (proto + s1) & (DICT_SLOTS - 1);
+
+  hit = (dict[slot].len == len && dict[slot].proto == proto);
+  for (i = 0; hit && i < len; i++) {
+    hit = (dict[slot].data[i] == data[i]);
+  }
+
+  if (hit) {
+    // Reference frame; the escape coding is the shortest for it
+    start_frame_coded (REF_PROTO, COMM_CODING_ESCAPE);
+    comm_send_byte ((proto << 3) | slot);
+    comm_send_byte (s2 & 127);
+    comm_end_frame ();
+    return;
+  }
+
+  // Store in the dictionary and send in full
+  dict[slot].len = len;
+  dict[slot].proto = proto;
+  for (i = 0; i < len; i++) {
+    dict[slot].data[i] = data[i];
+  }
+  comm_send_frame (proto, data, len);
 }
+#endif
+
+/**
+ * Send a hardcoded single-byte management frame: 0x80 code 0x00 code
+ *
+ * The frame goes through the priority lane of UART 0, so it is sent ahead of
+ * the data still waiting in the transmit buffer.
+ *
+ * All these frames report overflows or errors, so the dictionary is flushed.
+ */
+void comm_send_manag_code (const uint8_t code) {
+  uint8_t frame[4];
+
+#ifdef COMM_DICT
+  comm_dict_flush ();
+#endif
+
+  frame[0] = 0x80; // Frame start byte: address 0, management protocol
+  frame[1] = code;
+  frame[2] = 0x00; // hi-bits byte
+  frame[3] = code; // Parity: the frame start byte has no bits below the MSB
+  uart0_write_prio (frame, 4);
+  usage_count (0, MANAG_PROTO, 4);
+}
+
+#ifdef LINK_USAGE
+/**
+ * Send the "Link usage" management frames and reset the counters
+ *
+ * Every counter that counted a frame is sent as an entry of 5 bytes: a tag
+ * (the address, or 10h plus the protocol), the bytes and the frames. A frame
+ * holds two entries.
+ */
+int8_t comm_usage_report () {
+  uint8_t i, entries;
+  struct usage_counter *counter;
+
+  usage_reporting = 1;
+  entries = 0;
+  for (i = 0; i < 8 + 16; i++) {
+    counter = (i < 8) ? &usage_addr[i] : &usage_proto[i - 8];
+    if (!counter->frames) {
+      continue;
+    }
+
+    if (!(entries & 1)) {
+      comm_start_frame (MANAG_PROTO);
+      comm_send_byte (MANAG_STATS);
+      comm_send_byte (MANAG_STATS_USAGE);
+    }
+    comm_send_byte ((i < 8) ? i : i + 8); // Tag
+    comm_send_byte (counter->bytes >> 8);
+    comm_send_byte (counter->bytes & 0xff);
+    comm_send_byte (counter->frames >> 8);
+    comm_send_byte (counter->frames & 0xff);
+    if (entries & 1) {
+      comm_end_frame ();
+    }
+
+    counter->bytes = 0;
+    counter->frames = 0;
+    entries++;
+  }
+  if (entries & 1) {
+    comm_end_frame ();
+  }
+  usage_reporting = 0;
+
+  return entries != 0;
+}
+#endif
 
 /**
  * Inline function called by comm_forward() for reporting overflow.
@@ -278,10 +745,213 @@ static inline int8_t report_overflow() {
   CHAIN_OVERFLOW_VAR &= ~CHAIN_OVERFLOW_BIT;
   sei(); // End of critical section
 
-  uart0_put (0x80);
-  uart0_put (0x04);
-  uart0_put (0x00);
-  uart0_put (0x04);
+  comm_send_manag_code (0x04);
+  return -1;
+}
+
+/**
+ * Enable or disable aggregation of forwarded frames into containers
+ */
+void comm_set_aggregate (const uint8_t on) {
+  aggregate_enabled = on;
+}
+
+/**
+ * Decode the frame at position pos in the daisy-chain buffer into a container
+ * subframe at dst.
+ *
+ * head: end of the complete frames in the buffer
+ * room: free space at dst
+ * proto: protocol of the previous subframe; updated
+ * next: set to the position after the frame
+ *
+ * The parity of the frame is checked here, since the parity byte is not
+ * forwarded in a container.
+ *
+ * @returns the number of bytes put at dst, or 0 when the frame can't be put in
+ * the container: it is an error code or idle frame, fails its parity check or
+ * doesn't fit.
+ */
+static uint8_t decode_subframe (uint8_t pos, const uint8_t head,
+    uint8_t dst[], const uint8_t room, uint8_t *proto, uint8_t *next)
+{
+  uint8_t start, c, check, count, end, out, group, hi;
+
+  start = chain_at (pos);
+  if (start >= 0xF0 || (start & 15) == CONTAINER_PROTO) {
+    // Error code, or a container; containers are not nested
+    return 0;
+  }
+
+  // Find the end of the frame, computing the parity
+  check = start;
+  count = 0;
+  end = ring_next (uart1_rx_buffer, pos);
+  while (end != head && !((c = chain_at (end)) & (1 << 7))) {
+    check ^= c;
+    count++;
+    end = ring_next (uart1_rx_buffer, end);
+  }
+  if (count == 0) {
+    // 1-byte frame
+    return 0;
+  }
+  check &= 127;
+  count--; // Don't count the parity byte
+
+  // Leave room for the header
+  out = ((start & 15) == *proto) ? 1 : 2;
+  if (out >= room) {
+    return 0;
+  }
+  pos = ring_next (uart1_rx_buffer, pos);
+
+  if (check == ESCAPE_TAG) {
+    while (count--) {
+      c = chain_at (pos);
+      pos = ring_next (uart1_rx_buffer, pos);
+      if (c >= ESC_LIT) {
+        if (!count--) {
+          // Dangling escape
+          return 0;
+        }
+        hi = chain_at (pos);
+        pos = ring_next (uart1_rx_buffer, pos);
+        if (c == ESC_HI) {
+          c = hi | (1 << 7);
+        } else if (hi > 1) {
+          return 0;
+        } else {
+          c = ESC_LIT | hi;
+        }
+      }
+      if (out == room) {
+        return 0;
+      }
+      dst[out++] = c;
+    }
+  } else if (check == 0) {
+    while (count) {
+      // A group of up to 7 databytes followed by their hi-bits byte
+      group = (count > 8) ? 8 : count;
+      count -= group;
+      if (--group == 0) {
+        // Hi-bits byte without databytes
+        return 0;
+      }
+      hi = chain_at ((uint8_t) (pos + group) & ring_mask (uart1_rx_buffer));
+      while (group--) {
+        if (out == room) {
+          return 0;
+        }
+        dst[out++] = chain_at (pos) | ((hi & 1) << 7);
+        hi >>= 1;
+        pos = ring_next (uart1_rx_buffer, pos);
+      }
+      pos = ring_next (uart1_rx_buffer, pos); // Skip the hi-bits byte
+    }
+  } else {
+    // Bad parity: forward it as it is, for the PC to report
+    return 0;
+  }
+
+  // Fill in the header; the address is increased as when forwarding the frame,
+  // and room is small enough for the length to fit
+  hi = (start & 0x70) + (1 << 4);
+  if ((start & 15) == *proto) {
+    dst[0] = hi | (out - 1);
+  } else {
+    dst[0] = SUB_PROTO_FOLLOWS | hi | (out - 2);
+    dst[1] = start & 15;
+    *proto = start & 15;
+  }
+  *next = end;
+  return out;
+}
+
+#ifdef LINK_USAGE
+/**
+ * Count the subframes of a container that was just sent under their own
+ * address and protocol; only the rest of the container stays counted under
+ * the container itself.
+ *
+ * The container holds len decoded bytes and took wire bytes on the wire. A
+ * subframe is credited with the wire bytes of the data in proportion to it's
+ * decoded size, rounded down, so the credits never exceed what was counted
+ * for the container.
+ */
+static void usage_container (const uint8_t container[], const uint8_t len,
+    const uint8_t wire)
+{
+  uint8_t i, header, sub_len, sub_wire, proto;
+
+  proto = 0;
+  i = 0;
+  while (i < len) {
+    header = container[i];
+    sub_len = (header & 15) + 1;
+    if (header & SUB_PROTO_FOLLOWS) {
+      proto = container[i + 1];
+      sub_len++;
+    }
+    // Frame start byte and parity byte stay with the container
+    sub_wire = (uint16_t) sub_len * (wire - 2) / len;
+    usage_count ((header >> 4) & 7, proto, sub_wire);
+    usage_addr[0].bytes -= sub_wire;
+    usage_proto[CONTAINER_PROTO].bytes -= sub_wire;
+    i += sub_len;
+  }
+}
+#endif
+
+/**
+ * Forward the frames waiting in the daisy-chain buffer in a container, when
+ * that is shorter on the wire than forwarding them one by one.
+ *
+ * @returns non-zero when a container was sent, 0 otherwise.
+ */
+static int8_t forward_container () {
+  uint8_t container[CONTAINER_MAX_DATA];
+  uint8_t temp_head, pos, next, len, sub_len, proto, count, separate, combined;
+
+  temp_head = uart1_rx_buffer.head;
+  pos = uart1_rx_buffer.tail;
+  len = 0;
+  count = 0;
+  proto = 0xFF; // The first subframe always has its protocol byte
+  while (pos != temp_head) {
+    sub_len = decode_subframe (pos, temp_head, container + len,
+        CONTAINER_MAX_DATA - len, &proto, &next);
+    if (!sub_len) {
+      break;
+    }
+    len += sub_len;
+    count++;
+    pos = next;
+  }
+
+  if (count < 2) {
+    return 0;
+  }
+
+  // Wire size when forwarded one by one, and as a container in the shortest
+  // coding
+  separate = (uint8_t) (pos - uart1_rx_buffer.tail) & ring_mask (uart1_rx_buffer);
+  combined = (uint8_t) (len + 6) / 7;
+  sub_len = count_escapes (container, len);
+  if (sub_len < combined) {
+    combined = sub_len;
+  }
+  combined += len + 2;
+  if (combined >= separate) {
+    return 0;
+  }
+
+  uart1_rx_buffer.tail = pos;
+  send_frame_coded (CONTAINER_PROTO, container, len, COMM_CODING_AUTO);
+#ifdef LINK_USAGE
+  usage_container (container, len, combined);
+#endif
   return -1;
 }
 
@@ -294,6 +964,9 @@ static inline int8_t report_overflow() {
  * apparently the pressure on the buffer is high and we should try to alleviate
  * it.
  *
+ * When aggregation is enabled, the frames waiting in the buffer can be sent
+ * together in a single container frame instead.
+ *
  * Management frames are hardcoded for efficiency. Should the protocol be
  * changed such that the management frames:
  * - "Soft/hard overflow on incoming daisy-chain"
@@ -308,6 +981,9 @@ int8_t comm_forward() {
   uint8_t frame_start; // Frame start byte
   uint8_t parity_correct; // Correction to be applied to parity byte
   uint8_t old_data, new_data; // Bytes read from buffer
+#ifdef LINK_USAGE
+  uint8_t first_data; // Position of the first byte after the frame start
+#endif
 
   // Check for a frame to transmit
   temp_head = uart1_rx_buffer.head;
@@ -318,11 +994,17 @@ int8_t comm_forward() {
     return report_overflow();
   }
 
-  frame_start = uart1_rx_buffer.buf[temp_tail];
-  circ_buf_incr_ptr (&temp_tail, UART1_RX_BUFSIZE);
+  if (aggregate_enabled && forward_container ()) {
+    // Check for overflow
+    report_overflow();
+    return -1; // We sent a packet
+  }
+
+  frame_start = chain_at (temp_tail);
+  temp_tail = ring_next (uart1_rx_buffer, temp_tail);
   uart1_rx_buffer.tail = temp_tail;
 
-  while (temp_tail == temp_head || ((new_data = uart1_rx_buffer.buf[temp_tail]) & (1 << 7))) {
+  while (temp_tail == temp_head || ((new_data = chain_at (temp_tail)) & (1 << 7))) {
     // This is a one-byte frame
 
     switch (frame_start) {
@@ -336,17 +1018,14 @@ int8_t comm_forward() {
         }
         // Continue with the new frame
         frame_start = new_data;
-        circ_buf_incr_ptr (&temp_tail, UART1_RX_BUFSIZE);
+        temp_tail = ring_next (uart1_rx_buffer, temp_tail);
         uart1_rx_buffer.tail = temp_tail;
         break;
 
       case RECV_ERR_CHAIN_LONG:
         // Send the management frame "Chain too long"
         // Complete management frame: 0x80 0x03 0x00 0x03
-        uart0_put (0x80);
-        uart0_put (0x03);
-        uart0_put (0x00);
-        uart0_put (0x03);
+        comm_send_manag_code (0x03);
         // Check for overflow
         report_overflow();
         return -1; // We sent a packet
@@ -354,10 +1033,7 @@ int8_t comm_forward() {
       case RECV_ERR_H_OVERFLOW:
         // Send the management frame "Hard overflow on incoming daisy-chain"
         // Complete management frame: 0x80 0x05 0x00 0x05
-        uart0_put (0x80);
-        uart0_put (0x05);
-        uart0_put (0x00);
-        uart0_put (0x05);
+        comm_send_manag_code (0x05);
         // Check for overflow
         report_overflow();
         return -1; // We sent a packet
@@ -369,10 +1045,7 @@ int8_t comm_forward() {
          * Send the management frame "Malformed packet"
          * Complete management frame: 0x80 0x02 0x00 0x02
          */
-        uart0_put (0x80);
-        uart0_put (0x02);
-        uart0_put (0x00);
-        uart0_put (0x02);
+        comm_send_manag_code (0x02);
         // Check for overflow
         report_overflow();
         return -1; // We sent a packet
@@ -383,7 +1056,10 @@ int8_t comm_forward() {
    * the parity byte if it's an empty frame). However, tail still points at that
    * first byte.
    */
-  circ_buf_incr_ptr (&temp_tail, UART1_RX_BUFSIZE);
+#ifdef LINK_USAGE
+  first_data = temp_tail;
+#endif
+  temp_tail = ring_next (uart1_rx_buffer, temp_tail);
   uart1_rx_buffer.tail = temp_tail;
   
 
@@ -403,10 +1079,10 @@ int8_t comm_forward() {
   // Now output all databytes verbatim, but change the parity when we're at the
   // end
   old_data = new_data;
-  while (temp_head != temp_tail && !((new_data = uart1_rx_buffer.buf[temp_tail]) & (1 << 7))) {
+  while (temp_head != temp_tail && !((new_data = chain_at (temp_tail)) & (1 << 7))) {
     // There's another byte in the frame, so the old one wasn't the parity
 
-    circ_buf_incr_ptr (&temp_tail, UART1_RX_BUFSIZE);
+    temp_tail = ring_next (uart1_rx_buffer, temp_tail);
     uart1_rx_buffer.tail = temp_tail;
     uart0_put (old_data); // Send databyte
     // This assignment helps the compiler generate better code
@@ -418,6 +1094,10 @@ int8_t comm_forward() {
   // old_data now holds the parity byte; since we changed the address in the
   // frame start byte, we need to adjust it.
   uart0_put (old_data ^ parity_correct);
+#ifdef LINK_USAGE
+  usage_count ((frame_start >> 4) & 7, frame_start & 15, 1 +
+      ((uint8_t) (uart1_rx_buffer.tail - first_data) & ring_mask (uart1_rx_buffer)));
+#endif
   // And we're done
   // Check for overflow
   report_overflow();
@@ -425,6 +1105,76 @@ int8_t comm_forward() {
 }
 
 
+#ifdef CHAIN_AUTOBAUD
+/**
+ * Detect the bit rate of the daisy-chain
+ *
+ * Run every 10 ms. The errors and bytes are summed over up to
+ * AUTOBAUD_WINDOW runs, so even a board that only sends an Idle Frame now and
+ * then is detected. Does nothing once a rate is locked.
+ */
+int8_t comm_autobaud () {
+  static uint16_t bytes, errors, good;
+  static uint8_t runs;
+  uint8_t new_bytes, new_errors, i;
+
+  if (chain_locked) {
+    return 0;
+  }
+
+  cli(); // Start of critical section
+  new_bytes = chain_rx_bytes;
+  new_errors = chain_rx_errors;
+  chain_rx_bytes = 0;
+  chain_rx_errors = 0;
+  sei(); // End of critical section
+
+  bytes += new_bytes;
+  errors += new_errors;
+  if (!new_errors) {
+    good += new_bytes;
+  }
+
+  if (errors >= AUTOBAUD_MIN_ERRORS && errors >= bytes / 4) {
+    // Wrong rate, switch to the next one
+    for (i = 0; i < CHAIN_RATES && chain_rates[i] != chain_rate; i++) {
+      // Find the current rate
+    }
+    i = (i + 1 < CHAIN_RATES) ? i + 1 : 0;
+    chain_rate = chain_rates[i];
+    uart1_set_ubrr (F_CPU / (1600UL * chain_rate) - 1);
+
+    chain_hunting = 1;
+    good = 0;
+    bytes = errors = runs = 0;
+    return 0;
+  }
+
+  if (++runs == AUTOBAUD_WINDOW) {
+    bytes = errors = runs = 0;
+  }
+
+  if (good < AUTOBAUD_LOCK_BYTES) {
+    return 0;
+  }
+
+  chain_locked = 1;
+  if (!chain_hunting) {
+    // Locked at the rate we started with; nothing to report
+    return 0;
+  }
+
+  // Locked after a switch; report the rate
+  chain_hunting = 0;
+  comm_start_frame (MANAG_PROTO);
+  comm_send_byte (MANAG_CHAIN_RATE);
+  comm_send_byte (chain_rate >> 8);
+  comm_send_byte (chain_rate & 0xff);
+  comm_end_frame ();
+  return 1;
+}
+#endif
+
 /**
  * Inline function used by daisy-chain reception interrupt handler
  *
@@ -451,7 +1201,7 @@ static inline void errcode_and_framebyte (const uint8_t err, const uint8_t frame
 
   // Overwrite previous frame
   next_write_pos = head;
-  circ_buf_incr_ptr (&next_write_pos, UART1_RX_BUFSIZE);
+  next_write_pos = ring_next (uart1_rx_buffer, next_write_pos);
 
   if (next_write_pos == tail) {
     /* 
@@ -462,7 +1212,7 @@ static inline void errcode_and_framebyte (const uint8_t err, const uint8_t frame
      * Otherwise, the rest of the frame will be discarded.
      */
 
-    CHAIN_OVERFLOW_VAR |= CHAIN_OVERFLOW_BIT;
+    chain_overflow_set();
     
     if (framebyte >= 0xF0) {
       /* 
@@ -472,17 +1222,17 @@ static inline void errcode_and_framebyte (const uint8_t err, const uint8_t frame
        * interrupt routine to ignore the rest of the frame.
        */
 
-      uart1_rx_buffer.buf[head] = 0;
+      chain_at (head) = 0;
       return;
     }
 
-    uart1_rx_buffer.buf[head] = framebyte;
+    chain_at (head) = framebyte;
     *write_pos = next_write_pos;
     return;
   }
 
   // Put the errorcode in the buffer
-  uart1_rx_buffer.buf[head] = err;
+  chain_at (head) = err;
   
   if (framebyte >= 0xF0) {
     // This is the start of an incoming frame with address 7. The chain is too
@@ -490,44 +1240,44 @@ static inline void errcode_and_framebyte (const uint8_t err, const uint8_t frame
     
     // Increase the buffer pointers
     head = next_write_pos;
-    circ_buf_incr_ptr (&next_write_pos, UART1_RX_BUFSIZE);
+    next_write_pos = ring_next (uart1_rx_buffer, next_write_pos);
 
     if (next_write_pos == tail) {
       // No room to report the "chain too long" error, mark the byte at the 
       // (new) head as not starting the frame, to ignore the rest of the frame.
 
-      CHAIN_OVERFLOW_VAR |= CHAIN_OVERFLOW_BIT;
-      uart1_rx_buffer.buf[head] = 0;
+      chain_overflow_set();
+      chain_at (head) = 0;
       // Push out the first error code
-      uart1_rx_buffer.head = head;
+      ring_commit (uart1_rx_buffer, head);
       return;
     }
     
     // Pass the error code for "chain too long"
-    uart1_rx_buffer.buf[head] = RECV_ERR_CHAIN_LONG;
+    chain_at (head) = RECV_ERR_CHAIN_LONG;
 
     // Mark the byte at the head as not starting the frame, causing the
     // interrupt routine to ignore the rest of the frame.
-    uart1_rx_buffer.buf[next_write_pos] = 0;
+    chain_at (next_write_pos) = 0;
 
     // Push out the two error codes
-    uart1_rx_buffer.head = next_write_pos;
+    ring_commit (uart1_rx_buffer, next_write_pos);
     return;
   }
 
   // Put the received byte at the new head; if it's a frame start byte, we will
   // receive the next frame. Otherwise, the rest of the frame will be discarded.
-  uart1_rx_buffer.buf[next_write_pos] = framebyte;
+  chain_at (next_write_pos) = framebyte;
   // Push out the error code
-  uart1_rx_buffer.head = next_write_pos;
+  ring_commit (uart1_rx_buffer, next_write_pos);
 
-  circ_buf_incr_ptr (&next_write_pos, UART1_RX_BUFSIZE);
+  next_write_pos = ring_next (uart1_rx_buffer, next_write_pos);
   *write_pos = next_write_pos;
 }
 
 /**
- * This interrupt routine gets called when a byte has succesfully been received
- * on UART 1, the UART connecting to a daisy-chained board.
+ * Inline function doing the actual work for the daisy-chain reception
+ * interrupt handler below.
  *
  * It does some basic error checking that's best done here, and appends the byte
  * in the buffer. Only when the start of a new frame is detected, will the
@@ -548,15 +1298,20 @@ static inline void errcode_and_framebyte (const uint8_t err, const uint8_t frame
  * - Circular buffer overflow
  *
  * All but the overflows and daisy-chain length are reported as "Malformed Packet"
+ *
+ * status: contents of UCSR1A belonging to the received byte
+ * recv: the received byte
+ *
+ * Runs with interrupts enabled, see the interrupt handler.
  */
-ISR(USART1_RXC_vect) {
+static inline void chain_recv (const uint8_t, const uint8_t) __attribute__ ((always_inline));
+static inline void chain_recv (const uint8_t status, const uint8_t recv) {
   /**
    * Points to the next position to write in buffer 
    * Pointer undefined when the byte at the head of the buffer is not a
    * frame start byte!
    */
   static uint8_t write_pos;
-  uint8_t recv; // Received byte
   uint8_t temp_write_pos, temp_head, temp_tail;
   // Previous frame start byte 
   uint8_t prev_frame_start;
@@ -564,28 +1319,35 @@ ISR(USART1_RXC_vect) {
   temp_head = uart1_rx_buffer.head;
   temp_tail = uart1_rx_buffer.tail;
 
-  if (UCSR1A & _BV(FE1)) {
+#ifdef CHAIN_AUTOBAUD
+  if (chain_rx_bytes != UINT8_MAX) {
+    chain_rx_bytes++;
+  }
+#endif
+
+  if (status & _BV(FE1)) {
     // Framing error, send error code and discard the current frame
-    // We still need to read the UDR1 register to discard the received byte
-    recv = UDR1;
+    // The received byte is discarded
+
+#ifdef CHAIN_AUTOBAUD
+    if (chain_rx_errors != UINT8_MAX) {
+      chain_rx_errors++;
+    }
+#endif
 
     errcode_and_framebyte (RECV_ERR_MALFORMED, 0, &temp_write_pos, temp_head, temp_tail);
     return;
   }
 
-  if (UCSR1A & _BV(DOR1)) {
+  if (status & _BV(DOR1)) {
     // FIFO overflow. Send error code, discard the current frame and append the 
     // received byte.
 
-    recv = UDR1;
     errcode_and_framebyte (RECV_ERR_H_OVERFLOW, recv, &write_pos, temp_head, temp_tail);
     return;
   }
   
-  // Get received byte
-  recv = UDR1;
-
-  prev_frame_start = uart1_rx_buffer.buf[temp_head];
+  prev_frame_start = chain_at (temp_head);
 
   if (!(prev_frame_start & (1 << 7))) {
     // We were discarding databytes
@@ -612,8 +1374,8 @@ ISR(USART1_RXC_vect) {
     // Buffer free checks are not needed, the head is guaranteed to be
     // available
     temp_write_pos = temp_head;
-    uart1_rx_buffer.buf[temp_write_pos] = recv;
-    circ_buf_incr_ptr (&temp_write_pos, UART1_RX_BUFSIZE);
+    chain_at (temp_write_pos) = recv;
+    temp_write_pos = ring_next (uart1_rx_buffer, temp_write_pos);
     write_pos = temp_write_pos;
     return;
   }
@@ -623,9 +1385,10 @@ ISR(USART1_RXC_vect) {
   if (!(recv & (1 << 7))) {
     // This is a databyte in the current frame, just append it
 
-    if (!append_circ_buf (uart1_rx_buffer.buf, UART1_RX_BUFSIZE, recv, &temp_write_pos, temp_tail)) {
-      // Okay, set write_pos and we're done
-      write_pos = temp_write_pos;
+    if (temp_write_pos != temp_tail) {
+      // Okay, append it, set write_pos and we're done
+      chain_at (temp_write_pos) = recv;
+      write_pos = ring_next (uart1_rx_buffer, temp_write_pos);
       return;
     }
     
@@ -641,22 +1404,22 @@ ISR(USART1_RXC_vect) {
 
       temp_write_pos = temp_head;
       // Pass the error code
-      uart1_rx_buffer.buf[temp_write_pos] = RECV_ERR_MALFORMED;
-      circ_buf_incr_ptr (&temp_write_pos, UART1_RX_BUFSIZE);
+      chain_at (temp_write_pos) = RECV_ERR_MALFORMED;
+      temp_write_pos = ring_next (uart1_rx_buffer, temp_write_pos);
       // Mark the byte at the head as not starting the frame, causing this routine
       // to skip the rest of the data
-      uart1_rx_buffer.buf[temp_write_pos] = 0;
+      chain_at (temp_write_pos) = 0;
       // Push out the error code
-      uart1_rx_buffer.head = temp_write_pos;
+      ring_commit (uart1_rx_buffer, temp_write_pos);
       return;
     }
 
     // Discard the current frame
 
-    CHAIN_OVERFLOW_VAR |= CHAIN_OVERFLOW_BIT;
+    chain_overflow_set();
     // Mark the byte at the head as not starting the frame, causing this routine
     // to skip the rest of the data
-    uart1_rx_buffer.buf[temp_head] = 0;
+    chain_at (temp_head) = 0;
     return;
   }
 
@@ -676,19 +1439,19 @@ ISR(USART1_RXC_vect) {
 
       temp_write_pos = temp_head;
       // Pass the error code
-      uart1_rx_buffer.buf[temp_write_pos] = RECV_ERR_MALFORMED;
-      circ_buf_incr_ptr (&temp_write_pos, UART1_RX_BUFSIZE);
+      chain_at (temp_write_pos) = RECV_ERR_MALFORMED;
+      temp_write_pos = ring_next (uart1_rx_buffer, temp_write_pos);
       // Start the new frame at the head of the buffer 
-      uart1_rx_buffer.buf[temp_write_pos] = recv;
+      chain_at (temp_write_pos) = recv;
       // Push out the error code
-      uart1_rx_buffer.head = temp_write_pos;
+      ring_commit (uart1_rx_buffer, temp_write_pos);
 
-      circ_buf_incr_ptr (&temp_write_pos, UART1_RX_BUFSIZE);
+      temp_write_pos = ring_next (uart1_rx_buffer, temp_write_pos);
       write_pos = temp_write_pos;
       return;
     }
 
-    CHAIN_OVERFLOW_VAR |= CHAIN_OVERFLOW_BIT;
+    chain_overflow_set();
 
     if (recv >= 0xF0) {
       // This is the start of an incoming frame with address 7. The chain is too
@@ -699,8 +1462,8 @@ ISR(USART1_RXC_vect) {
     }
 
     temp_write_pos = temp_head;
-    uart1_rx_buffer.buf[temp_write_pos] = recv;
-    circ_buf_incr_ptr (&temp_write_pos, UART1_RX_BUFSIZE);
+    chain_at (temp_write_pos) = recv;
+    temp_write_pos = ring_next (uart1_rx_buffer, temp_write_pos);
     write_pos = temp_write_pos;
     return;
   }
@@ -714,10 +1477,45 @@ ISR(USART1_RXC_vect) {
     return;
   }
 
-  uart1_rx_buffer.buf[temp_write_pos] = recv;
+  chain_at (temp_write_pos) = recv;
   // And push out the previous frame
-  uart1_rx_buffer.head = temp_write_pos;
+  ring_commit (uart1_rx_buffer, temp_write_pos);
 
-  circ_buf_incr_ptr (&temp_write_pos, UART1_RX_BUFSIZE);
+  temp_write_pos = ring_next (uart1_rx_buffer, temp_write_pos);
   write_pos = temp_write_pos;
 }
+
+/**
+ * This interrupt routine gets called when a byte has succesfully been received
+ * on UART 1, the UART connecting to a daisy-chained board.
+ *
+ * The AVR has no interrupt priorities. While this handler runs, the sampling
+ * interrupt of the monitor (the 10 uS DCC sampler in particular) is delayed,
+ * skewing the sample moment or even missing a sample completely. Therefore
+ * only the work that needs to be atomic is done with interrupts disabled:
+ * reading the UART registers and masking this interrupt. The processing of the
+ * byte is done with interrupts enabled again.
+ *
+ * Masking the UART1 receive interrupt guards against reentrancy: another byte
+ * may already be waiting in the UART FIFO, and it will only be handled after
+ * we are done with this one. The FIFO is deep enough for that; processing a
+ * byte takes much less than the time needed to receive one.
+ *
+ * The reentrancy guard is removed again with interrupts disabled, so the
+ * interrupt can only fire again after the RETI of this handler.
+ */
+ISR(USART1_RXC_vect) {
+  uint8_t status, recv;
+
+  // Status flags first; they belong to the byte at the front of the FIFO
+  status = UCSR1A;
+  recv = UDR1;
+
+  UCSR1B &= ~(_BV(RXCIE1)); // Reentrancy guard
+  sei(); // Allow the sampling interrupts of the monitor
+
+  chain_recv (status, recv);
+
+  cli();
+  UCSR1B |= _BV(RXCIE1); // Remove reentrancy guard
+}
@@ -27,6 +27,13 @@
 
 #include <stdint.h>
 
+/**
+ * Line codings of the databytes in a frame, see comm_set_line_coding()
+ */
+#define COMM_CODING_HIBITS 0 // 7-in-8 coding with hi-bits bytes (default)
+#define COMM_CODING_ESCAPE 1 // Escape coding
+#define COMM_CODING_AUTO 2 // Shortest of both for frames from comm_send_frame()
+
 /**
  * Initialise idle timer for Idle Frame management
  *
@@ -46,14 +53,35 @@ extern void comm_start_idle_timer();
  * sent to the UART transmission routines. No data should be sent to the UART
  * after the call to comm_start_idle_timer() !
  */
-extern void comm_check_idle_timer(const uint16_t now);
+extern void comm_check_idle_timer(const uint32_t now);
+
+/**
+ * Set the timeout for sending an Idle Frame
+ *
+ * After UART 0 has been idle for longer than msecs milliseconds, an Idle Frame
+ * is sent. The maximum is about 6 seconds. The default is 100 ms.
+ */
+extern void comm_set_idle_timeout (const uint16_t msecs);
 
 /**
  * Pause outgoing transmission for long enough to allow the receiver to
  * synchronize on the startbit.
+ *
+ * With UART0_TX_POLLED, the pause simply consists of not feeding the UART.
  */
 extern void comm_sync_pause ();
 
+/**
+ * Select the line coding for the frames sent by this board
+ *
+ * The 7-in-8 coding costs one byte per 7 databytes, the escape coding one
+ * byte per databyte of 7Eh or higher. Every frame identifies its own line
+ * coding, so boards in a daisy-chain can use different codings.
+ *
+ * Precondition: not called between comm_start_frame() and comm_end_frame().
+ */
+extern void comm_set_line_coding (const uint8_t coding);
+
 /**
  * Starts a communication protocol frame on the outgoing serial port with 
  * address 0 and protocol proto.
@@ -74,6 +102,75 @@ extern void comm_send_byte (const uint8_t c);
  */
 extern void comm_end_frame ();
 
+/**
+ * Sends a complete communication protocol frame with address 0, protocol
+ * proto and len databytes from data.
+ *
+ * With COMM_CODING_AUTO, the line coding giving the shortest frame is chosen.
+ */
+extern void comm_send_frame (const uint8_t proto, const uint8_t data[],
+    const uint8_t len);
+
+/**
+ * Sends a complete communication protocol frame of len bytes that is already
+ * in wire form, starting with the frame start byte and ending with the parity
+ * byte.
+ *
+ * For monitors that encode their frames as they receive them. The frame
+ * should have address 0.
+ */
+extern void comm_send_wire (const uint8_t frame[], const uint8_t len);
+
+#ifdef COMM_DICT
+/**
+ * Enable or disable references to the dictionary of recently sent frames
+ *
+ * Only present when COMM_DICT is defined. Disabled by default. Flushes the
+ * dictionary.
+ */
+extern void comm_set_dict (const uint8_t on);
+
+/**
+ * Empty the dictionary of recently sent frames
+ *
+ * Should be run periodically, every DICT_FLUSH_PERIOD, to limit the time the
+ * copy of the PC stays wrong after a lost frame. Always returns 0, for use as
+ * a software timer job.
+ */
+extern int8_t comm_dict_flush ();
+
+/**
+ * Like comm_send_frame(), but when the dictionary is enabled and the same
+ * frame is in the dictionary of recently sent frames, a short reference frame
+ * is sent instead.
+ *
+ * Only for protocols that are specified to use the dictionary; the PC stores
+ * every frame of such a protocol.
+ */
+extern void comm_send_frame_dict (const uint8_t proto, const uint8_t data[],
+    const uint8_t len);
+#endif
+
+/**
+ * Enable or disable aggregation of forwarded frames into containers
+ *
+ * When enabled, comm_forward() sends the complete frames waiting in the
+ * daisy-chain buffer in a single container frame, when that is shorter.
+ * Frames are never held back for it. Disabled by default.
+ */
+extern void comm_set_aggregate (const uint8_t on);
+
+/**
+ * Send a management frame consisting of just the message code.
+ *
+ * Meant for loss notifications: the frame is sent in the priority lane of
+ * UART 0, at the next frame boundary instead of after the data still waiting
+ * in the transmit buffer.
+ *
+ * Precondition: not called between comm_start_frame() and comm_end_frame().
+ */
+extern void comm_send_manag_code (const uint8_t code);
+
 /**
  * Forward an incoming frame from the daisy-chain, if available.
  *
@@ -94,4 +191,45 @@ extern void comm_end_frame ();
  */
 extern int8_t comm_forward();
 
+/**
+ * Number of bytes in the daisy-chain reception buffer
+ *
+ * Gauges the pressure on the link: when it fills up, the monitor can spend
+ * less link time on its own frames.
+ */
+extern uint8_t comm_rx_used ();
+
+#ifdef CHAIN_AUTOBAUD
+/**
+ * Detect the bit rate of the board behind us in the daisy-chain
+ *
+ * Only present when CHAIN_AUTOBAUD is defined. Should be run every 10 ms. When
+ * the daisy-chain input shows many framing errors, the next bit rate is tried;
+ * when a new rate receives without errors, it is reported in a "Daisy-chain
+ * bit rate" management frame. The first rate that receives without errors is
+ * kept until reset. Returns non-zero when a frame was sent.
+ */
+extern int8_t comm_autobaud ();
+#endif
+
+#ifdef LINK_USAGE
+/**
+ * Report the bytes and frames sent on UART 0 per address and per protocol
+ *
+ * Should be run every second by a software timer; "Link usage" management
+ * frames are sent and the counters are reset. Returns non-zero when a frame
+ * was sent. Only present when LINK_USAGE is defined.
+ */
+extern int8_t comm_usage_report ();
+#endif
+
+#ifdef RING_HWM
+/**
+ * Read and reset the high-water mark of the daisy-chain reception buffer
+ *
+ * Only present when RING_HWM is defined.
+ */
+extern uint8_t comm_rx_hwm ();
+#endif
+
 #endif // ndef FILE_COMM_PROTO_H
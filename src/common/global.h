@@ -41,10 +41,27 @@
  * UART0 transmit buffer size
  *
  * Used for sending out the communication protocol
- * Maximum of 256 (pointers are 8-bit)
- * A power of 2 results in more optimal code
+ * Must be a power of 2, maximum of 256 (pointers are 8-bit; see ring.h)
+ *
+ * With RING_ALIGN256 it is a 256-byte ring on a 256-byte boundary, see
+ * Makefile.common.
  */
+#ifdef RING_ALIGN256
+#define UART0_TX_BUFSIZE 256
+#else
 #define UART0_TX_BUFSIZE 16
+#endif
+
+/**
+ * UART0 transmit priority lane size
+ *
+ * Used for management frames that should not wait for the data in the
+ * transmit buffer, see uart.c. Should at least hold one hardcoded management
+ * frame: 4 bytes.
+ *
+ * Must be a power of 2, maximum of 256 (pointers are 8-bit; see ring.h)
+ */
+#define UART0_PRIO_BUFSIZE 8
 
 /**
  * UART1 receive buffer size
@@ -56,15 +73,49 @@
  * In reality it should be bigger, because a maximally sized frame might not get
  * sent out immediately on reception. 
  *
- * Maximum of 256 (pointers are 8-bit)
- * A power of 2 results in more optimal code
+ * Must be a power of 2, maximum of 256 (pointers are 8-bit; see ring.h)
+ *
+ * With RING_ALIGN256 it is a 256-byte ring on a 256-byte boundary, see
+ * Makefile.common.
  */
+#ifdef RING_ALIGN256
+#define UART1_RX_BUFSIZE 256
+#else
 #define UART1_RX_BUFSIZE 32
+#endif
+
+/**
+ * UART0 receive buffer size
+ *
+ * Used for receiving Command protocol frames from the PC (or the previous board
+ * in the daisy-chain). Should at least hold the largest command frame on the
+ * wire: 17 bytes.
+ *
+ * Must be a power of 2, maximum of 256 (pointers are 8-bit; see ring.h)
+ */
+#define UART0_RX_BUFSIZE 32
+
+/**
+ * UART1 transmit buffer size
+ *
+ * Used for relaying Command protocol frames to a daisy-chained board. A frame
+ * is only relayed when it fits completely, so this should at least be one
+ * larger than the largest command frame on the wire: 18 bytes.
+ *
+ * Must be a power of 2, maximum of 256 (pointers are 8-bit; see ring.h)
+ */
+#define UART1_TX_BUFSIZE 32
+
+/**
+ * Period of flushing the dictionary of recently sent frames, see comm_proto.c
+ */
+#define DICT_FLUSH_PERIOD (1 seconds)
 
 /**
  * Maximum number of databytes in a frame
  *
- * Frames with 12 databytes are 16 bytes long on the wire
+ * Frames with 12 databytes are 16 bytes long on the wire with the 7-in-8 line
+ * coding, and at most 26 bytes with the escape coding.
  */
 #define MAX_FRAME_SIZE 12
 
@@ -129,25 +180,65 @@
  * Communication protocol definitions
  */
 #define MANAG_PROTO 0 // Management protocol has number 0
+#define REF_PROTO 13 // Dictionary references, see comm_proto.c
+#define CONTAINER_PROTO 14 // Containers of forwarded frames, see comm_proto.c
 // First bytes
 #define MANAG_HELLO 0 // Management proto hello message
 #define MANAG_BUS_OVF 1 // Management protocol "Overflow on monitored bus" message
 #define MANAG_TEST  6 // Management protocol test functions
 #define MANAG_DCC_OOB 7 // Management protocol DCC out-of-band data
+#define MANAG_STATS 8 // Management protocol statistics
+#define MANAG_CMD_ACK 9 // Management protocol "Command acknowledge" message
+#define MANAG_CHAIN_RATE 10 // Management protocol "Daisy-chain bit rate" message
 
 // MANAG_TEST second bytes
 #define MANAG_TEST_COMM 0 // Management protocol "Communication protocol" test
 #define MANAG_TEST_FORWARD 1 // Management protocol "Communication forward" test
+#define MANAG_TEST_JITTER 2 // Management protocol "Sampler jitter" report
 
 // MANAG_DCC_OOB second bytes
 #define MANAG_DCC_NO_ACC_FILTER 0 // No longer filtering on Accessory Decoders
 #define MANAG_DCC_ACC_FILTER 1 // Filtering on Accessory Decoders
+#define MANAG_DCC_SHED 2 // Load-shedding summary
+#define MANAG_DCC_STATS 3 // Signal statistics
+#define MANAG_DCC_VALIDATE 4 // Bad DCC packets
+#define MANAG_DCC_RULE_HITS 5 // Filter rule hits
+#define MANAG_DCC_ELIDED 6 // Elided idle and reset packets
+#define MANAG_DCC_SUMMARY 7 // Summary of the DCC packets
+
+// MANAG_STATS second bytes
+#define MANAG_STATS_CMD 0 // Command protocol statistics
+#define MANAG_STATS_HWM 1 // Buffer high-water marks
+#define MANAG_STATS_USAGE 2 // Link usage per address and protocol
+
+/**
+ * Command protocol definitions
+ *
+ * Commands 0-15 are common to all boards, 16-127 are free for the specific
+ * protocol monitor.
+ */
+#define CMD_PING 0 // Do nothing, only acknowledge
+#define CMD_IDLE_TIMEOUT 1 // Set Idle Frame timeout
+#define CMD_STATS 2 // Send statistics
+#define CMD_LINE_CODING 3 // Select line coding of the Communication protocol
+#define CMD_DICT 4 // Enable or disable dictionary references
+#define CMD_AGGREGATE 5 // Enable or disable containers of forwarded frames
+#define CMD_SLOTS 6 // Set the schedule of time-slotted transmission
+#define CMD_MONITOR 16 // First command number for the specific monitor
+
+// Result codes in the "Command acknowledge" message
+#define CMD_OK 0 // Command executed
+#define CMD_UNKNOWN 1 // Command not known by this board
+#define CMD_BAD_ARGS 2 // Wrong number or value of arguments
+#define CMD_FAILED 3 // Board ran out of resources to execute the command
+#define CMD_NO_ACK 0xFF // Internal: don't acknowledge the command
 
 /**
  * Globally available variable for miscellaneous purpose
  *
  * It is used in interrupt contexts, so access should be
- * atomic.
+ * atomic. Note that the UART1 reception handler runs with interrupts enabled,
+ * so this also holds for that handler.
  *
  * Current uses:
  * bit 0: comm_proto.c: CHAIN_OVERFLOW_BIT
@@ -220,38 +311,33 @@ extern int8_t monitor_send();
 extern int8_t handle_keys();
 
 /**
- * Inline function to do circular buffer arithmetic.
+ * Command handler
  *
- * Compiler optimises out the test for buffer size (provided it's constant,
- * obviously).
+ * Called by the main loop for every Command protocol frame addressed to this
+ * board that is not one of the commands common to all boards. cmd[0] is the
+ * command number, followed by the len - 1 arguments. All bytes are 7-bit.
+ *
+ * It can be implemented by the specific protocol monitor the firmware is being
+ * built for. If not, a default is used that does not know any command.
+ *
+ * Returns one of the CMD_OK, CMD_UNKNOWN, CMD_BAD_ARGS or CMD_FAILED result
+ * codes. The main loop acknowledges the command to the PC with it, after any
+ * frames the handler sent itself.
  */
-static inline void circ_buf_incr_ptr (uint8_t* pointer, const uint8_t bufsize) {
-  if (bufsize & (bufsize - 1)) {
-    // bufsize is not a power of 2; use simple increase
-    if (*pointer >= bufsize - 1) {
-      *pointer = 0;
-    } else { \
-      (*pointer)++;
-    }
-  } else {
-    // bufsize is a power of 2; use optimized increase
-    *pointer = (*pointer + 1) & (bufsize - 1);
-  }
-}
+extern uint8_t monitor_command(const uint8_t cmd[], const uint8_t len);
 
+#ifdef RING_HWM
 /**
- * Inline function for appending the byte in argument c to a circular buffer with overflow check.
+ * Buffer high-water mark of the monitor
+ *
+ * Only present when RING_HWM is defined. Returns and resets the highest number
+ * of buffer positions in use in the buffer between the monitor and the main
+ * loop.
  *
- * Returns non-zero when the buffer is full.
+ * It can be implemented by the specific protocol monitor the firmware is being
+ * built for. If not, a default is used that always returns 0.
  */
-static inline int8_t append_circ_buf (volatile uint8_t buf[], const uint8_t bufsize, const uint8_t c, uint8_t* head, const uint8_t tail) {
-  if (*head == tail) {
-    // Buffer full
-    return -1;
-  }
-  buf[*head] = c;
-  circ_buf_incr_ptr (head, bufsize);
-  return 0;
-}
+extern uint8_t monitor_hwm();
+#endif
 
 #endif // ndef FILE_GLOBAL_H
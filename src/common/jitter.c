@@ -0,0 +1,80 @@
+/**
+ * Sampler jitter measurement
+ *
+ * Instrumentation for measuring the interrupt latency of the sampling interrupt
+ * of a monitor. Only built when MEASURE_JITTER is defined.
+ *
+ * The report is sent as a Management protocol test function:
+ * 06h 02h MIN MAX OVR UDH UDL
+ * MIN, MAX: minimum and maximum latency in timer ticks
+ * OVR: number of missed sample moments
+ * UDH, UDL: number of UART0 transmit interrupts (high and low byte)
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include "global.h"
+#include "comm_proto.h"
+#include "jitter.h"
+
+uint8_t jitter_min = UINT8_MAX;
+uint8_t jitter_max;
+uint8_t jitter_overruns;
+uint16_t jitter_udre_count;
+
+/**
+ * Report the jitter measurements
+ *
+ * Run every second by a software timer; a "Sampler jitter" management frame is
+ * sent and the statistics are reset.
+ *
+ * Returns non-zero when a frame was sent, zero otherwise.
+ */
+int8_t jitter_report () {
+  uint8_t min, max, overruns;
+  uint16_t udre_count;
+
+  cli(); // Start of critical section
+  min = jitter_min;
+  max = jitter_max;
+  overruns = jitter_overruns;
+  udre_count = jitter_udre_count;
+  jitter_min = UINT8_MAX;
+  jitter_max = 0;
+  jitter_overruns = 0;
+  jitter_udre_count = 0;
+  sei(); // End of critical section
+
+  if (min > max) {
+    // The sampler did not run at all
+    return 0;
+  }
+
+  comm_start_frame (MANAG_PROTO); // Management protocol
+  comm_send_byte (MANAG_TEST); // Test functions
+  comm_send_byte (MANAG_TEST_JITTER); // "Sampler jitter" report
+  comm_send_byte (min);
+  comm_send_byte (max);
+  comm_send_byte (overruns);
+  comm_send_byte (udre_count >> 8);
+  comm_send_byte (udre_count & 0xff);
+  comm_end_frame ();
+  return 1;
+}
@@ -0,0 +1,88 @@
+/**
+ * Sampler jitter measurement header file
+ *
+ * Instrumentation for measuring the interrupt latency of the sampling interrupt
+ * of a monitor. Only built when MEASURE_JITTER is defined.
+ *
+ * The sampling interrupt calls jitter_record() as early as possible, with the
+ * number of timer ticks elapsed since the compare match that triggered it. The
+ * main loop reports the minimum and maximum latency every second. The
+ * difference between the two is the jitter on the sample moment; the minimum
+ * is the fixed cost of the interrupt prologue.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ * 
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_JITTER_H
+#define FILE_JITTER_H
+
+#include <stdint.h>
+
+/**
+ * Latency statistics since the last report.
+ *
+ * Only written by the sampling interrupt; read and reset by jitter_report()
+ * with interrupts disabled.
+ */
+extern uint8_t jitter_min, jitter_max;
+/**
+ * Number of samples that were taken so late that the next sample moment had
+ * already passed (saturates at 255).
+ */
+extern uint8_t jitter_overruns;
+
+/**
+ * Number of UART0 transmit interrupts since the last report.
+ *
+ * Incremented by the UDRE interrupt handler in uart.c; zero when the firmware is
+ * built with UART0_TX_POLLED. Multiplied with the cycle count of the handler
+ * (from the disassembly), this gives the cycles per second spent on it.
+ */
+extern uint16_t jitter_udre_count;
+
+/**
+ * Record the latency of a single run of the sampling interrupt
+ *
+ * latency: timer ticks since the compare match
+ * missed: non-zero when the compare flag was already set again, meaning a
+ *         sample moment was missed
+ */
+static inline void jitter_record (const uint8_t, const uint8_t) __attribute__ ((always_inline));
+static inline void jitter_record (const uint8_t latency, const uint8_t missed) {
+  if (latency < jitter_min) {
+    jitter_min = latency;
+  }
+  if (latency > jitter_max) {
+    jitter_max = latency;
+  }
+  if (missed && jitter_overruns != UINT8_MAX) {
+    jitter_overruns++;
+  }
+}
+
+/**
+ * Report the jitter measurements
+ *
+ * Should be called every second (main.c registers it as a software timer). A
+ * "Sampler jitter" management frame is sent and the statistics are reset.
+ *
+ * Returns non-zero when a frame was sent, zero otherwise.
+ */
+extern int8_t jitter_report ();
+
+#endif // ndef FILE_JITTER_H
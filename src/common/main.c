@@ -3,7 +3,7 @@
  *
  * It initialises the monitor and sends any data received by the monitor.
  *
- * Daisy-chained frames are forwarded.
+ * Daisy-chained frames are forwarded, and commands from the PC are executed.
  *
  * After powerup or a reset, the hardware is initialised and a "Hello"
  * management protocol message is sent.
@@ -37,9 +37,15 @@
 #include "global.h"
 #include "uart.h"
 #include "comm_proto.h"
+#include "cmd_proto.h"
 #include "test_dispatch.h"
 #include "timer.h"
+#include "rtc.h"
 #include "keys.h"
+#include "slots.h"
+#ifdef MEASURE_JITTER
+#include "jitter.h"
+#endif
 
 // Global miscellaneous variables; see global.h
 volatile uint8_t global_prot_var;
@@ -142,30 +148,50 @@ int8_t handle_keys () {
   return 0;
 }
 
+/**
+ * Job run every 10 milliseconds
+ *
+ * We check the keys on the board every 10 milliseconds, and send maximally one
+ * test frame every 10 milliseconds.
+ */
+static int8_t centisec_job () {
+  int8_t active;
+
+  active = handle_keys();
+#ifdef CHAIN_AUTOBAUD
+  active |= comm_autobaud();
+#endif
+#ifdef INCLUDE_TESTS
+  active |= test_send();
+#endif
+  return active;
+}
+
+/**
+ * Job run every 2 seconds
+ *
+ * We insert an 8-bitperiod pause on the outgoing serial stream about every 2
+ * seconds. This pause allows resynchronization of startbits on sender and
+ * receiver if they somehow got out-of-sync.
+ */
+static int8_t sync_pause_job () {
+  comm_sync_pause();
+  return 0;
+}
+
 /**
  * Main loop
  *
  * Initialises the hardware, calls the initialisation functions for subsystems,
  * sends a "Hello" and manages the data flow between the subsystems.
  *
+ * Periodic jobs are run by the software timers of rtc.c.
+ *
  * It never returns.
  */
 static void main_loop () {
   uint8_t active, last_active; // For idle checking
-  uint16_t now; // Current "real" time
-  /**
-   * Last time we paused the outgoing serial stream for synchronization
-   * purposes.
-   * It's the higher byte of the 16-bit RTC at that time.
-   *
-   * This means that the period of 2 seconds we check for should be a sensible
-   * period to compare against on the high byte of the RTC. This should not be a
-   * problem.
-   */
-  uint8_t last_pause;
-  uint8_t pause_diff; // Difference between now and last_pause
-  uint8_t last_centisec_time; // The last time 10 msec had passed
-  uint8_t centisec_time_diff; // Time passed since last_centisec_time
+  uint32_t now; // Current "real" time
 
   // Pullups enabled (unconnected pins; defined level -> saves power)
   // init_monitor() below will change some of this later.
@@ -175,7 +201,7 @@ static void main_loop () {
   PORTD = 255;
 
   // Init Real Time Clock
-  TCCR1B = _BV(CS12) | _BV (CS10); // Prescaler /1024, start in normal mode
+  rtc_init();
 
 	sei(); // Enable interrupts
 
@@ -191,50 +217,45 @@ static void main_loop () {
 
   last_active = 1; // We sent the hello message
 
-  // Get "real" time
-  cli(); // Start of critical section
-  now = TCNT1;
-  sei(); // End of critical section
-
-  last_pause = now >> 8; // Just an initialisation value
+  // Periodic jobs
+  timer_add (centisec_job, rtc_period (10 mseconds), rtc_period (10 mseconds));
+  timer_add (sync_pause_job, rtc_period (2 seconds), rtc_period (2 seconds));
+#ifdef COMM_DICT
+  timer_add (comm_dict_flush, rtc_period (DICT_FLUSH_PERIOD),
+      rtc_period (DICT_FLUSH_PERIOD));
+#endif
+#ifdef MEASURE_JITTER
+  timer_add (jitter_report, rtc_period (1 seconds), rtc_period (1 seconds));
+#endif
+#ifdef LINK_USAGE
+  timer_add (comm_usage_report, rtc_period (1 seconds), rtc_period (1 seconds));
+#endif
 
-  last_centisec_time = (uint8_t) now; // Just an initialisation value
+  // Get "real" time
+  now = rtc_now();
   
   for (;;) {
-    active = 0; // Initialise to inactive
-
-    /* We check the keys on the board every 10 milliseconds, and send maximally
-     * one test frame every 10 milliseconds.
-     * To save storage and computation time, we only work on the lower 8 bits of
-     * the "Real" Time Clock. This means the loop has to run often enough to
-     * have centisec_time_diff be bigger than rtc_period (10 mseconds) before
-     * centisec_time_diff wraps back to 0. This is a very loose constraint, and
-     * I don't foresee any problems, but it should be noted.
-     */
-    // Is it time yet?
-    centisec_time_diff = now - last_centisec_time; // 8-bit arithmetic!
-    if (centisec_time_diff > rtc_period (10 mseconds)) {
-      // Yes, another 10 msec have passed
-      
-      active |= handle_keys();
-#ifdef INCLUDE_TESTS
-      active |= test_send();
-#endif
-
-      // Update timestamp
-      last_centisec_time = (uint8_t) now;
-    }
+    // Run due periodic jobs, record activity
+    active = timer_run (now);
 
     // Forward daisy-chained frame, record activity
     active |= comm_forward(); 
 
-    // Send data from the monitor, record activity
-    active |= monitor_send();
+    // Execute command from the PC, record activity
+    active |= cmd_receive();
+
+    // Send data from the monitor in our time slot, record activity
+    if (slots_open ()) {
+      active |= monitor_send();
+    }
+
+#ifdef UART0_TX_POLLED
+    // There is no transmit interrupt, keep the UART busy from here
+    uart0_poll();
+#endif
 
     // Get "real time"
-    cli(); // Start of critical section
-    now = TCNT1;
-    sei(); // End of critical section
+    now = rtc_now();
 
     if (!active && last_active) {
       // Last time we sent a packet, now we didn't
@@ -248,19 +269,6 @@ static void main_loop () {
       comm_check_idle_timer (now);
     }
 
-    // We insert an 8-bitperiod pause on the outgoing serial stream about
-    // every 2 seconds. This pause allows resynchronization of startbits on sender
-    // and receiver if they somehow got out-of-sync.
-    pause_diff = (now >> 8) - last_pause;
-    if (pause_diff > (rtc_period (2 seconds) >> 8)) {
-      // 2 seconds passed since last pause, do it again
-
-      comm_sync_pause();
-
-      // We paused now
-      last_pause = (now >> 8);
-    }
-
     // Set last_active for next run
     last_active = active;
   }	
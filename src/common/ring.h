@@ -0,0 +1,369 @@
+/**
+ * Ring buffer routines
+ *
+ * Circular buffers of bytes with 8-bit head and tail pointers, used for all
+ * data passed between interrupt handlers and the main loop.
+ *
+ * A ring is declared with the RING(size) type. The size must be a power of 2,
+ * maximally 256; this is checked at compile time. The routines are inline and
+ * get the size from the declaration, so all buffer arithmetic is reduced to a
+ * single AND with a constant.
+ *
+ * The producer owns the head, the consumer owns the tail. One position is
+ * always kept free to tell a full ring from an empty one. Producers may write
+ * data past the head before pushing it out with ring_commit(); this is how
+ * complete frames are presented to the consumer at once.
+ *
+ * The batch routines read the pointers of the other side once and write their
+ * own pointer once, instead of once per byte.
+ *
+ * When RING_HWM is defined, every ring also records the highest number of
+ * bytes it held (its high-water mark). It is updated whenever the producer
+ * pushes data, and read and reset with ring_hwm_take(). Rings declared by hand
+ * can include RING_HWM_MEMBER to record it as well.
+ *
+ * A ring of 256 bytes whose buffer starts on a 256-byte boundary can be
+ * indexed with ring_page_at(): the address of a byte is the upper byte of the
+ * buffer address with the pointer as lower byte, without any addition. With
+ * RING_ALIGN256, the linker places the rings declared with RING_AT_BOTTOM and
+ * RING_AT_TOP that way, see Makefile.common.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_RING_H
+#define FILE_RING_H
+
+#include <stdint.h>
+#include <avr/interrupt.h>
+
+#ifdef RING_HWM
+#define RING_HWM_MEMBER volatile uint8_t hwm;
+#define ring_hwm_ptr(r) (&(r).hwm)
+#else
+#define RING_HWM_MEMBER
+#define ring_hwm_ptr(r) ((volatile uint8_t *) 0)
+#endif
+
+/**
+ * Type of a ring of 'size' bytes
+ *
+ * Usage example: static RING(32) my_ring;
+ */
+#define RING(size) struct { \
+  volatile uint8_t buf[size]; \
+  volatile uint8_t head, tail; \
+  RING_HWM_MEMBER \
+}
+
+/**
+ * Type of a ring of 'size' bytes with the buffer after the pointers
+ *
+ * For a ring whose buffer should end at the top of SRAM.
+ */
+#define RING_BUF_LAST(size) struct { \
+  volatile uint8_t head, tail; \
+  RING_HWM_MEMBER \
+  volatile uint8_t buf[size]; \
+}
+
+/**
+ * Placement of 256-byte rings with RING_ALIGN256
+ *
+ * RING_AT_BOTTOM: a RING(256) whose buffer starts at the bottom of SRAM.
+ * RING_AT_TOP: a RING_BUF_LAST(256) whose buffer ends at the top of SRAM.
+ *
+ * The sections are not cleared by the startup code; clear the pointers with
+ * ring_clear() before use.
+ *
+ * Usage example: static RING(256) my_ring RING_AT_BOTTOM;
+ */
+#define RING_AT_BOTTOM __attribute__ ((section (".ring_bottom")))
+#define RING_AT_TOP __attribute__ ((section (".ring_top")))
+
+/**
+ * Mask for the pointers of a ring of 'size' bytes
+ *
+ * Fails to compile when size is not a power of 2 or bigger than 256.
+ */
+#define ring_size_mask(size) ((uint8_t) ((size) - 1 \
+      + 0 * sizeof (char [((size) & ((size) - 1)) || (size) > 256 ? -1 : 1])))
+
+/**
+ * Pointer following pointer i in a ring of 'size' elements
+ *
+ * For rings with other elements than bytes, that are declared by hand.
+ */
+#define ring_size_next(i, size) ((uint8_t) ((i) + 1) & ring_size_mask (size))
+
+/**
+ * Mask for the pointers of ring r
+ */
+#define ring_mask(r) ring_size_mask (sizeof ((r).buf))
+
+/**
+ * Pointer following pointer i in ring r
+ */
+#define ring_next(r, i) ((uint8_t) ((i) + 1) & ring_mask (r))
+
+/**
+ * Byte at pointer i of ring r, whose buffer starts on a 256-byte boundary
+ *
+ * The lower byte of the buffer address is known to be 0, so it is replaced by
+ * the pointer instead of added to it.
+ */
+#define ring_page_at(r, i) (*(volatile uint8_t *) \
+    (((uintptr_t) (r).buf & 0xFF00) | (uint8_t) (i)))
+
+/**
+ * Empty ring r, and reset it's high-water mark
+ */
+#ifdef RING_HWM
+#define ring_clear(r) do { \
+  (r).head = 0; \
+  (r).tail = 0; \
+  (r).hwm = 0; \
+} while (0)
+#else
+#define ring_clear(r) do { \
+  (r).head = 0; \
+  (r).tail = 0; \
+} while (0)
+#endif
+
+/**
+ * Number of bytes in ring r
+ */
+#define ring_used(r) ((uint8_t) ((r).head - (r).tail) & ring_mask (r))
+
+/**
+ * Number of bytes that can still be pushed in ring r
+ */
+#define ring_free(r) ((uint8_t) ((r).tail - (r).head - 1) & ring_mask (r))
+
+/**
+ * Check whether ring r is empty
+ */
+#define ring_empty(r) ((r).head == (r).tail)
+
+/**
+ * Byte at the tail of ring r
+ *
+ * Precondition: ring not empty.
+ */
+#define ring_peek(r) ((r).buf[(r).tail])
+
+/**
+ * ring_peek() for a ring whose buffer starts on a 256-byte boundary
+ */
+#define ring_page_peek(r) ring_page_at (r, (r).tail)
+
+/**
+ * Record the high-water mark for a ring with the given pointers.
+ */
+static inline void ring_hwm_ (volatile uint8_t *, const uint8_t, const uint8_t,
+    const uint8_t) __attribute__ ((always_inline));
+static inline void ring_hwm_ (volatile uint8_t *hwm, const uint8_t head,
+    const uint8_t tail, const uint8_t mask)
+{
+  uint8_t used;
+
+  if (!hwm) {
+    // Not recording high-water marks
+    return;
+  }
+  used = (head - tail) & mask;
+  if (used > *hwm) {
+    *hwm = used;
+  }
+}
+
+/**
+ * Push out the data the producer has written up to (not including) pointer
+ * pos in ring r.
+ *
+ * Precondition: pos is not the tail, or the ring would look empty.
+ */
+#define ring_commit(r, pos) do { \
+  uint8_t ring_pos_ = (pos); \
+  (r).head = ring_pos_; \
+  ring_hwm_ (ring_hwm_ptr (r), ring_pos_, (r).tail, ring_mask (r)); \
+} while (0)
+
+static inline int8_t ring_push_ (volatile uint8_t [], volatile uint8_t *,
+    const uint8_t, const uint8_t, volatile uint8_t *, const uint8_t)
+  __attribute__ ((always_inline));
+static inline int8_t ring_push_ (volatile uint8_t buf[], volatile uint8_t *head,
+    const uint8_t tail, const uint8_t mask, volatile uint8_t *hwm,
+    const uint8_t c)
+{
+  uint8_t temp_head, next;
+
+  temp_head = *head;
+  next = (temp_head + 1) & mask;
+  if (next == tail) {
+    // Ring full
+    return -1;
+  }
+  buf[temp_head] = c;
+  *head = next;
+  ring_hwm_ (hwm, next, tail, mask);
+  return 0;
+}
+
+/**
+ * Push byte c in ring r
+ *
+ * Returns non-zero when the ring is full; c is not pushed then.
+ */
+#define ring_push(r, c) ring_push_ ((r).buf, &(r).head, (r).tail, \
+    ring_mask (r), ring_hwm_ptr (r), (c))
+
+static inline int8_t ring_push_n_ (volatile uint8_t [], volatile uint8_t *,
+    const uint8_t, const uint8_t, volatile uint8_t *, const uint8_t [],
+    uint8_t) __attribute__ ((always_inline));
+static inline int8_t ring_push_n_ (volatile uint8_t buf[], volatile uint8_t *head,
+    const uint8_t tail, const uint8_t mask, volatile uint8_t *hwm,
+    const uint8_t src[], uint8_t n)
+{
+  uint8_t temp_head;
+
+  temp_head = *head;
+  if (((tail - temp_head - 1) & mask) < n) {
+    // Doesn't fit
+    return -1;
+  }
+  for (; n > 0; n--) {
+    buf[temp_head] = *src++;
+    temp_head = (temp_head + 1) & mask;
+  }
+  *head = temp_head;
+  ring_hwm_ (hwm, temp_head, tail, mask);
+  return 0;
+}
+
+/**
+ * Push n bytes from src in ring r
+ *
+ * Either all bytes are pushed, or none at all. Returns non-zero when they don't
+ * fit.
+ */
+#define ring_push_n(r, src, n) ring_push_n_ ((r).buf, &(r).head, (r).tail, \
+    ring_mask (r), ring_hwm_ptr (r), (src), (n))
+
+static inline void ring_pop_n_ (volatile uint8_t [], volatile uint8_t *,
+    const uint8_t, uint8_t [], uint8_t) __attribute__ ((always_inline));
+static inline void ring_pop_n_ (volatile uint8_t buf[], volatile uint8_t *tail,
+    const uint8_t mask, uint8_t dst[], uint8_t n)
+{
+  uint8_t temp_tail;
+
+  temp_tail = *tail;
+  for (; n > 0; n--) {
+    *dst++ = buf[temp_tail];
+    temp_tail = (temp_tail + 1) & mask;
+  }
+  *tail = temp_tail;
+}
+
+/**
+ * Pop n bytes from ring r into dst
+ *
+ * Precondition: ring_used (r) >= n.
+ */
+#define ring_pop_n(r, dst, n) ring_pop_n_ ((r).buf, &(r).tail, \
+    ring_mask (r), (dst), (n))
+
+/**
+ * Pop a byte from ring r
+ *
+ * Precondition: ring not empty.
+ */
+#define ring_pop(r) ({ \
+  uint8_t ring_tail_ = (r).tail; \
+  uint8_t ring_c_ = (r).buf[ring_tail_]; \
+  (r).tail = ring_next (r, ring_tail_); \
+  ring_c_; \
+})
+
+/**
+ * ring_pop() for a ring whose buffer starts on a 256-byte boundary
+ */
+#define ring_page_pop(r) ({ \
+  uint8_t ring_tail_ = (r).tail; \
+  uint8_t ring_c_ = ring_page_at (r, ring_tail_); \
+  (r).tail = ring_next (r, ring_tail_); \
+  ring_c_; \
+})
+
+static inline uint8_t ring_peek_span_ (const uint8_t, const uint8_t,
+    const uint8_t) __attribute__ ((always_inline));
+static inline uint8_t ring_peek_span_ (const uint8_t head, const uint8_t tail,
+    const uint8_t mask)
+{
+  uint8_t used, to_end;
+
+  used = (head - tail) & mask;
+  to_end = mask - tail + 1; // Wraps to 0 for a 256 byte ring at tail 0
+  if (to_end && used > to_end) {
+    return to_end;
+  }
+  return used;
+}
+
+/**
+ * Number of bytes that can be read from ring r starting at the tail without
+ * wrapping around: they are at (r).buf[(r).tail] and onwards.
+ *
+ * Release them with ring_skip().
+ */
+#define ring_peek_span(r) ring_peek_span_ ((r).head, (r).tail, ring_mask (r))
+
+/**
+ * Release n bytes at the tail of ring r
+ *
+ * Precondition: ring_used (r) >= n.
+ */
+#define ring_skip(r, n) ((r).tail = ((uint8_t) ((r).tail + (n))) & ring_mask (r))
+
+#ifdef RING_HWM
+/**
+ * Read and reset the high-water mark of ring r
+ *
+ * Only present when RING_HWM is defined.
+ */
+#define ring_hwm_take(r) ring_size_hwm_take (r, sizeof ((r).buf))
+
+/**
+ * ring_hwm_take() for a ring declared by hand with RING_HWM_MEMBER, holding
+ * size entries per array
+ *
+ * The mark restarts at the current fill level, not at zero, so data that
+ * stays in the ring is still accounted for in the next period.
+ */
+#define ring_size_hwm_take(r, size) ({ \
+  uint8_t ring_hwm_; \
+  cli(); \
+  ring_hwm_ = (r).hwm; \
+  (r).hwm = (uint8_t) ((r).head - (r).tail) & ring_size_mask (size); \
+  sei(); \
+  ring_hwm_; \
+})
+#endif
+
+#endif // ndef FILE_RING_H
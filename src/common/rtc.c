@@ -0,0 +1,218 @@
+/**
+ * Real Time Clock and software timers
+ *
+ * TIMER1 runs freely at F_CPU / 1024; the overflow interrupt counts the upper
+ * 16 bits of the 32-bit time.
+ *
+ * The software timers are a small table of deadlines. The earliest deadline is
+ * cached, so the main loop only pays for a single comparison when nothing is
+ * due. Jobs run from the main loop, never from interrupt context.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include "global.h"
+#include "rtc.h"
+
+/**
+ * Upper 16 bits of the 32-bit time
+ */
+static volatile uint16_t rtc_overflows;
+
+/**
+ * Software timer table
+ *
+ * A timer with a zero job is free. 'armed' is non-zero when the job should run
+ * at the deadline.
+ */
+static struct {
+  uint32_t deadline;
+  uint16_t period;
+  timer_job job;
+  uint8_t armed;
+} timers[TIMER_SLOTS];
+
+/**
+ * The earliest deadline of all armed timers. When no timer is armed, it is
+ * about half the 32-bit range ahead.
+ */
+static uint32_t timer_next;
+
+/**
+ * Is deadline 'a' before deadline 'b'?
+ *
+ * Signed difference, to be safe across the wraparound of the time.
+ */
+#define time_before(a, b) ((int32_t) ((a) - (b)) < 0)
+
+/**
+ * The overflow interrupt extends the RTC to 32 bits
+ */
+ISR(TIMER1_OVF_vect) {
+  rtc_overflows++;
+}
+
+/**
+ * Start the Real Time Clock
+ */
+void rtc_init () {
+  TCCR1B = _BV(CS12) | _BV (CS10); // Prescaler /1024, start in normal mode
+  TIMSK |= _BV(TOIE1); // Enable TIMER1 Overflow Interrupt
+  timer_next = INT32_MAX; // No timer armed
+}
+
+/**
+ * Get the current 32-bit "real" time from an interrupt handler
+ *
+ * When the counter overflowed but the overflow interrupt has not run yet, the
+ * overflow flag is still set. The counter is only used as wrapped when it is
+ * low; a high counter value was read before the overflow.
+ */
+uint32_t rtc_now_unlocked () {
+  uint16_t lo, hi;
+
+  lo = TCNT1;
+  hi = rtc_overflows;
+  if ((TIFR & _BV(TOV1)) && !(lo & 0x8000)) {
+    // Pending overflow
+    hi++;
+  }
+  return ((uint32_t) hi << 16) | lo;
+}
+
+/**
+ * Get the current 32-bit "real" time
+ */
+uint32_t rtc_now () {
+  uint32_t now;
+
+  cli(); // Start of critical section
+  now = rtc_now_unlocked ();
+  sei(); // End of critical section
+  return now;
+}
+
+/**
+ * Recompute the cached earliest deadline
+ */
+static void timer_update_next (const uint32_t now) {
+  uint8_t i;
+  uint32_t next;
+
+  next = now + INT32_MAX; // Nothing armed
+  for (i = 0; i < TIMER_SLOTS; i++) {
+    if (timers[i].armed && time_before (timers[i].deadline, next)) {
+      next = timers[i].deadline;
+    }
+  }
+  timer_next = next;
+}
+
+/**
+ * Register a software timer
+ */
+int8_t timer_add (const timer_job job, const uint16_t delay,
+    const uint16_t period)
+{
+  uint8_t i;
+
+  for (i = 0; i < TIMER_SLOTS; i++) {
+    if (!timers[i].job) {
+      // Free slot
+      timers[i].job = job;
+      timers[i].period = period;
+      timer_start (i, delay);
+      return i;
+    }
+  }
+
+  // Table full
+  return -1;
+}
+
+/**
+ * (Re)start a software timer to run its job 'delay' ticks from now
+ */
+void timer_start (const uint8_t timer, const uint16_t delay) {
+  uint32_t now;
+
+  now = rtc_now ();
+  timers[timer].deadline = now + delay;
+  timers[timer].armed = 1;
+  timer_update_next (now);
+}
+
+/**
+ * Change the period of a software timer
+ */
+void timer_set_period (const uint8_t timer, const uint16_t period) {
+  timers[timer].period = period;
+}
+
+/**
+ * Stop a software timer
+ *
+ * The cached earliest deadline is left as it is; at worst, timer_run() scans
+ * the table once for nothing.
+ */
+void timer_stop (const uint8_t timer) {
+  timers[timer].armed = 0;
+}
+
+/**
+ * Run the jobs of all timers whose deadline has passed
+ *
+ * Periodic timers keep their phase: the next deadline is one period after the
+ * previous one. If the main loop was so late that this is still in the past,
+ * missed runs are skipped instead of being run in a burst.
+ */
+int8_t timer_run (const uint32_t now) {
+  uint8_t i;
+  int8_t active;
+
+  if (time_before (now, timer_next)) {
+    // Nothing due
+    return 0;
+  }
+
+  active = 0;
+  for (i = 0; i < TIMER_SLOTS; i++) {
+    if (!timers[i].armed || time_before (now, timers[i].deadline)) {
+      continue;
+    }
+
+    if (timers[i].period) {
+      timers[i].deadline += timers[i].period;
+      if (!time_before (now, timers[i].deadline)) {
+        // Fell behind, skip missed runs
+        timers[i].deadline = now + timers[i].period;
+      }
+    } else {
+      // One-shot
+      timers[i].armed = 0;
+    }
+
+    active |= timers[i].job ();
+  }
+
+  timer_update_next (now);
+  return active;
+}
@@ -0,0 +1,109 @@
+/**
+ * Real Time Clock and software timers header file
+ *
+ * TIMER1 runs freely at F_CPU / 1024 as the "real time clock" of the firmware.
+ * These routines extend it to 32 bits by counting its overflows, and run jobs
+ * at deadlines expressed in that time.
+ *
+ * All times are in RTC ticks; use rtc_period() from timer.h to compute them.
+ * A 32-bit time wraps around after about 4.6 days; deadlines are compared by
+ * signed difference, so that is harmless for periods up to half of it.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_RTC_H
+#define FILE_RTC_H
+
+#include <stdint.h>
+
+/**
+ * Maximum number of software timers
+ *
+ * The DCC monitor built with all reporting options uses all of them.
+ */
+#define TIMER_SLOTS 10
+
+/**
+ * A job run by a software timer
+ *
+ * Should return non-zero when a frame has been sent, to record activity of the
+ * Communication Protocol.
+ */
+typedef int8_t (*timer_job) ();
+
+/**
+ * Start the Real Time Clock
+ *
+ * Should be called once, before any other routine in this file.
+ */
+extern void rtc_init ();
+
+/**
+ * Get the current 32-bit "real" time
+ */
+extern uint32_t rtc_now ();
+
+/**
+ * Get the current 32-bit "real" time from an interrupt handler
+ *
+ * Precondition: global interrupts disabled.
+ */
+extern uint32_t rtc_now_unlocked ();
+
+/**
+ * Register a software timer
+ *
+ * The job is run for the first time 'delay' ticks from now, and then every
+ * 'period' ticks. A period of 0 makes it a one-shot timer, which can be
+ * started again with timer_start().
+ *
+ * Returns the timer number, or -1 when all TIMER_SLOTS are taken.
+ */
+extern int8_t timer_add (const timer_job job, const uint16_t delay,
+    const uint16_t period);
+
+/**
+ * (Re)start a software timer to run its job 'delay' ticks from now
+ */
+extern void timer_start (const uint8_t timer, const uint16_t delay);
+
+/**
+ * Change the period of a software timer
+ *
+ * Takes effect at the next run of the job; use timer_start() to restart it
+ * with the new period right away.
+ */
+extern void timer_set_period (const uint8_t timer, const uint16_t period);
+
+/**
+ * Stop a software timer; its job is not run until it is started again
+ */
+extern void timer_stop (const uint8_t timer);
+
+/**
+ * Run the jobs of all timers whose deadline has passed
+ *
+ * Argument 'now' gives the current "real" time. When no deadline has passed,
+ * this is a single comparison.
+ *
+ * Returns non-zero when any job sent a frame.
+ */
+extern int8_t timer_run (const uint32_t now);
+
+#endif // ndef FILE_RTC_H
@@ -0,0 +1,179 @@
+/**
+ * Time-slotted transmission
+ *
+ * Normally, every board sends it's frames as soon as they are available, and a
+ * chatty board can hold up the frames of the boards behind it for as long as
+ * it keeps talking. In time-slotted mode, time is divided in cycles of a number
+ * of equal slots, one per board. A board only sends the data of it's monitor
+ * in its own slot; frames from the daisy-chain are forwarded all the time.
+ * The data of a monitor then waits at most one cycle for its slot.
+ *
+ * The schedule is distributed downstream by the boards themselves: the PC
+ * sends it to the head board, which takes slot 0 and passes the schedule on to
+ * the next board with slot 1, and so on. Receiving the schedule also starts the
+ * cycle, so every board runs slightly behind the board before it: the time
+ * needed to pass the schedule on, about a millisecond. The head board repeats
+ * the schedule about every second to correct the drift of the clocks, and to
+ * reach boards that missed it.
+ *
+ * The schedule can only be passed on when there is room in the relay buffer.
+ * When there isn't, it is tried again at the end of every slot, or in free
+ * transmission every RETRY_PERIOD, until it is queued. Switching back to free
+ * transmission is not repeated, so without this, boards further down would
+ * keep their slots.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include "global.h"
+#include "timer.h"
+#include "rtc.h"
+#include "cmd_proto.h"
+#include "slots.h"
+
+/**
+ * The highest number of boards in a daisy-chain
+ *
+ * With slots of at most 127 ms, a cycle takes at most about a second. Monitors
+ * rely on that bound: the DCC monitor stores only the lower 16 bits of the
+ * time of a packet (dcc_packet_time()), which are only right while the packet
+ * is less than a wrap of Timer1, about 6 seconds, old when it is sent. More or
+ * longer slots need a wider time there.
+ */
+#define MAX_BOARDS 8
+
+/**
+ * Time between attempts to pass the schedule on in free transmission
+ */
+#define RETRY_PERIOD (10 mseconds)
+
+// The schedule
+static uint8_t slot_count; // Slots in a cycle; 0: free transmission
+static uint8_t slot_len; // Length of a slot in milliseconds
+static uint8_t slot_mine; // Slot of this board
+
+static uint8_t slot_current; // Slot running now
+static uint8_t slot_cycles; // Cycles between repeats of the schedule
+static uint8_t slot_repeat; // Cycles left until the next repeat
+static int8_t slot_timer = -1; // Software timer ending the slots, -1: none yet
+static uint8_t slot_pending; // Non-zero while the schedule still has to be passed on
+
+/**
+ * Pass the schedule on to the next board, with the next slot.
+ *
+ * When switching back to free transmission, it is passed on to all boards a
+ * daisy-chain can have. When it can't be queued, slot_pending is set.
+ */
+static void slots_pass_on () {
+  uint8_t cmd[4];
+
+  slot_pending = 0;
+  if (slot_mine + 1 >= (slot_count ? slot_count : MAX_BOARDS)) {
+    // No next board in the schedule
+    return;
+  }
+
+  cmd[0] = CMD_SLOTS;
+  cmd[1] = slot_count;
+  cmd[2] = slot_len;
+  cmd[3] = slot_mine + 1;
+  slot_pending = !cmd_send_downstream (cmd, 4);
+}
+
+/**
+ * End the current slot
+ *
+ * Run by a software timer at the end of every slot. At the start of a cycle,
+ * the head board repeats the schedule when it's due. In free transmission, the
+ * timer only runs while the schedule still has to be passed on.
+ */
+static int8_t slots_tick () {
+  if (slot_pending) {
+    slots_pass_on ();
+  }
+
+  if (!slot_count) {
+    if (slot_pending) {
+      timer_start (slot_timer, rtc_period (RETRY_PERIOD));
+    }
+    return 0;
+  }
+
+  if (++slot_current == slot_count) {
+    slot_current = 0;
+
+    if (slot_mine == 0 && --slot_repeat == 0) {
+      slot_repeat = slot_cycles;
+      slots_pass_on ();
+    }
+  }
+  return 0;
+}
+
+/**
+ * Set the schedule and start a cycle
+ */
+uint8_t slots_set (const uint8_t count, const uint8_t len, const uint8_t slot) {
+  uint16_t period;
+
+  if (slot_timer < 0) {
+    slot_timer = timer_add (slots_tick, 0, 0);
+    if (slot_timer < 0) {
+      // No software timer left
+      return 0;
+    }
+    timer_stop (slot_timer);
+  }
+
+  slot_count = count;
+  slot_len = len;
+  slot_mine = slot;
+  slot_current = 0;
+
+  if (count) {
+    // Slot length in RTC ticks, rounded to nearest
+    period = ((uint32_t) len * rtc_period (1 seconds) + 500) / 1000;
+    timer_set_period (slot_timer, period);
+    timer_start (slot_timer, period);
+
+    // About a second of cycles between repeats
+    slot_cycles = 1000 / ((uint16_t) count * len);
+    if (!slot_cycles) {
+      slot_cycles = 1;
+    }
+    slot_repeat = slot_cycles;
+  } else {
+    // Free transmission
+    timer_set_period (slot_timer, 0);
+    timer_stop (slot_timer);
+  }
+
+  slots_pass_on ();
+  if (!count && slot_pending) {
+    timer_start (slot_timer, rtc_period (RETRY_PERIOD));
+  }
+  return 1;
+}
+
+/**
+ * May this board send the data of it's monitor now?
+ */
+uint8_t slots_open () {
+  return !slot_count || slot_current == slot_mine;
+}
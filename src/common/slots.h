@@ -0,0 +1,56 @@
+/**
+ * Time-slotted transmission header file
+ *
+ * Defines the routines that restrict the sending of monitored data to the time
+ * slot of this board, for a bounded latency of every board in the daisy-chain.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_SLOTS_H
+#define FILE_SLOTS_H
+
+#include <stdint.h>
+
+/**
+ * Set the schedule and start a cycle
+ *
+ * count: number of slots in a cycle, 1-8; 0 switches back to free transmission
+ * len: length of a slot in milliseconds, 1-127
+ * slot: slot of this board, below count
+ *
+ * The schedule is passed on to the next board in the daisy-chain, with the
+ * next slot; when there is no room to queue it, it is tried again until there
+ * is.
+ *
+ * Returns 0 when no software timer was left for the slots, without changing
+ * the schedule; non-zero otherwise.
+ *
+ * Precondition: rtc_init() has been called.
+ */
+extern uint8_t slots_set (const uint8_t count, const uint8_t len,
+    const uint8_t slot);
+
+/**
+ * May this board send the data of it's monitor now?
+ *
+ * Returns non-zero in the slot of this board, and always in free transmission
+ * (the default).
+ */
+extern uint8_t slots_open ();
+
+#endif // ndef FILE_SLOTS_H
@@ -5,7 +5,9 @@
  * protocol by sending a stream of frames, both correct and incorrect, and
  * checking on the receiving side if the frames are as expected.
  *
- * The results are constant to automate the process.
+ * The results are constant to automate the process. The regular frames are
+ * sent in the line coding selected for the board, so run the test once for
+ * every line coding.
  *
  * The test is stateful: loss of packets causes the receiver to go out-of-sync
  * and report errors for a correct stream.
@@ -147,6 +149,22 @@ int8_t do_comm_test (const uint8_t test_proto) {
         break;
 
       case 6:
+        // Malformed escape coded frame: escape without the escaped byte
+        uart0_put (test_proto | (1 << 7)); // Frame start byte
+        uart0_put (0x7F); // Escape for a byte with the MSB set
+        uart0_put ((test_proto ^ 0x7F ^ 0x55) & 127); // Tagged parity
+        break;
+
+      case 7:
+        // Malformed escape coded frame: the escape for 7Eh and 7Fh only takes
+        // 00h and 01h
+        uart0_put (test_proto | (1 << 7)); // Frame start byte
+        uart0_put (0x7E); // Escape for 7Eh and 7Fh
+        uart0_put (0x02);
+        uart0_put ((test_proto ^ 0x7E ^ 0x02 ^ 0x55) & 127); // Tagged parity
+        break;
+
+      case 8:
         // Impossibly big frame
         comm_start_frame (test_proto);
         for (uint8_t cnt = 0; cnt < MAX_FRAME_SIZE + 1; cnt++) {
@@ -155,7 +173,7 @@ int8_t do_comm_test (const uint8_t test_proto) {
         comm_end_frame ();
         break;
 
-      case 7:
+      case 9:
       default: // Only possible state left, optimisation
         // We're done, send a management protocol frame indicating so
         comm_start_frame (MANAG_PROTO); // Management protocol
@@ -27,14 +27,65 @@
 #include <stdint.h>
 #include "global.h"
 #include "uart.h"
+#include "ring.h"
+#ifdef MEASURE_JITTER
+#include "jitter.h"
+#endif
 
 /**
- * UART0 reception circular buffer
+ * UART0 transmission circular buffer (the bulk lane)
+ *
+ * With RING_ALIGN256, it's buffer fills the top 256 bytes of SRAM, so the
+ * transmit interrupt can index it without any address arithmetic.
+ */
+#ifdef RING_ALIGN256
+static RING_BUF_LAST(UART0_TX_BUFSIZE) uart0_tx_buffer RING_AT_TOP;
+#define tx_peek() ring_page_peek (uart0_tx_buffer)
+#define tx_pop() ring_page_pop (uart0_tx_buffer)
+
+/**
+ * The ring is not in .bss, so it's pointers are cleared here. Runs from the
+ * startup code, like jump_main_loop() in main.c.
+ */
+static void uart0_tx_buffer_clear () __attribute__ ((naked, section (".init7"), used));
+static void uart0_tx_buffer_clear () {
+  ring_clear (uart0_tx_buffer);
+}
+#else
+static RING(UART0_TX_BUFSIZE) uart0_tx_buffer;
+#define tx_peek() ring_peek (uart0_tx_buffer)
+#define tx_pop() ring_pop (uart0_tx_buffer)
+#endif
+
+/**
+ * UART0 priority lane
+ *
+ * Holds only complete frames, placed at once by uart0_write_prio(). They are
+ * sent at the next frame boundary in the bulk lane, so they don't have to wait
+ * for the bulk lane to drain.
+ *
+ * A frame boundary is recognised by the MSB of the next byte in the bulk lane:
+ * only frame start bytes have it set. An empty bulk lane is also a boundary,
+ * because priority frames are only queued between bulk frames, by the same
+ * code that queues the bulk frames. So by the time a priority frame is queued,
+ * any bulk frame in progress is completely in the buffer.
  */
-static struct {
-  volatile uint8_t buf[UART0_TX_BUFSIZE];
-  volatile uint8_t head, tail;
-} uart0_tx_buffer;
+static RING(UART0_PRIO_BUFSIZE) uart0_prio_buffer;
+
+/**
+ * Take the next byte to transmit from one of the two lanes
+ *
+ * Precondition: at least one of the lanes is not empty.
+ */
+static inline uint8_t uart0_tx_next () __attribute__ ((always_inline));
+static inline uint8_t uart0_tx_next () {
+  if (!ring_empty (uart0_prio_buffer) && (ring_empty (uart0_tx_buffer)
+        || (tx_peek () & (1 << 7)))) {
+    // At a frame boundary in the bulk lane
+    return ring_pop (uart0_prio_buffer);
+  }
+  return tx_pop ();
+}
 
 /*
  * Initialise UARTs, and enable
@@ -50,35 +101,67 @@ void uart_init () {
   UBRR1H = ((F_CPU / (16UL * UART_BAUD)) - 1) >> 8;
   UBRR1L = ((F_CPU / (16UL * UART_BAUD)) - 1) & 0xff;
 
-  // Enable UARTs, UART1 RX complete interrupt
-  UCSR0B = _BV(RXEN0) | _BV(TXEN0);
+  // Enable UARTs, RX complete interrupts (UART0 carries the Command protocol,
+  // see cmd_proto.c)
+  UCSR0B = _BV(RXCIE0) | _BV(RXEN0) | _BV(TXEN0);
   UCSR1B = _BV(RXCIE1) | _BV(RXEN1) | _BV(TXEN1);
 }
 
+/**
+ * Change the bit rate of UART 1
+ */
+void uart1_set_ubrr (const uint16_t ubrr) {
+  UBRR1H = ubrr >> 8;
+  UBRR1L = ubrr & 0xff;
+}
+
+#ifndef UART0_TX_POLLED
 /**
  * Transmit a byte through UART 0.
  *
  * This is a blocking routine. If the buffer is full, it will busy-wait.
  *
- * Instead of using a bit to store the status of the buffer, the USART
- * Data Register Empty Interrupt Enable is used: when the buffer is emptied
- * by the transmit interrupt handler, it disables itself, so we can use that
- * for status.
+ * The transmit interrupt disables itself when it empties the buffer, so it is
+ * enabled again for every byte.
  */
 void uart0_put (const uint8_t c) {
-  uint8_t temp_head;
-
-  temp_head = uart0_tx_buffer.head;
-  while (temp_head == uart0_tx_buffer.tail && bit_is_set (UCSR0B, UDRIE0)) {
+  while (ring_push (uart0_tx_buffer, c)) {
     // Buffer is full
   }
 
-  uart0_tx_buffer.buf[temp_head] = c; // Place byte in buffer
-  
-  // Increase buffer head
-  circ_buf_incr_ptr(&temp_head, UART0_TX_BUFSIZE);
+  // Clear TXC flag (used for Idle Frame management in comm_proto.c)
+  UCSR0A |= _BV(TXC0);
+  // Enable transmit interrupt
+  UCSR0B |= _BV(UDRIE0);
+}
+
+/**
+ * Transmit n bytes through UART 0.
+ *
+ * Like uart0_put(), but all bytes are placed in the buffer at once. n should
+ * be smaller than UART0_TX_BUFSIZE.
+ */
+void uart0_write (const uint8_t src[], const uint8_t n) {
+  while (ring_push_n (uart0_tx_buffer, src, n)) {
+    // Not enough room in the buffer
+  }
+
+  // Clear TXC flag (used for Idle Frame management in comm_proto.c)
+  UCSR0A |= _BV(TXC0);
+  // Enable transmit interrupt
+  UCSR0B |= _BV(UDRIE0);
+}
 
-  uart0_tx_buffer.head = temp_head;
+/**
+ * Transmit a complete frame of n bytes through UART 0 in the priority lane.
+ *
+ * The frame is sent at the next frame boundary of the data given to uart0_put()
+ * and uart0_write(). n should be smaller than UART0_PRIO_BUFSIZE.
+ */
+void uart0_write_prio (const uint8_t src[], const uint8_t n) {
+  while (ring_push_n (uart0_prio_buffer, src, n)) {
+    // Not enough room in the buffer
+  }
 
   // Clear TXC flag (used for Idle Frame management in comm_proto.c)
   UCSR0A |= _BV(TXC0);
@@ -89,37 +172,140 @@ void uart0_put (const uint8_t c) {
 /**
  * Interrupt handler for transmitting data through UART 0 (UDR empty interrupt)
  *
- * This handler should only be active when there is data in the buffer, so we 
- * don't test that.
+ * This handler should only be active when there is data in one of the lanes,
+ * so we don't test that.
  */
 ISR(USART0_UDRE_vect) {
-  uint8_t temp_tail;
+#ifdef MEASURE_JITTER
+  jitter_udre_count++;
+#endif
 
-  temp_tail = uart0_tx_buffer.tail;
-  UDR0 = uart0_tx_buffer.buf[temp_tail]; // Get byte from buffer
-  circ_buf_incr_ptr(&temp_tail, UART0_TX_BUFSIZE); // Increase pointer
+  UDR0 = uart0_tx_next ();
 
-  if (temp_tail == uart0_tx_buffer.head) {
-    // Buffer empty, disable this interrupt
+  if (ring_empty (uart0_tx_buffer) && ring_empty (uart0_prio_buffer)) {
+    // Both lanes empty, disable this interrupt
     UCSR0B &= ~(_BV(UDRIE0));
   }
-  uart0_tx_buffer.tail = temp_tail;
 }
 
 /**
- * Receive a byte through UART 0.
+ * Check whether UART 0 has finished transmitting everything it was given.
+ *
+ * uart0_put() clears the TXC flag for every byte placed in the buffer, so the
+ * flag is only set when all of them have been sent out.
+ */
+uint8_t uart0_tx_idle () {
+  return bit_is_set (UCSR0A, TXC0);
+}
+
+#else // UART0_TX_POLLED
+
+/**
+ * Feed UART 0 from the transmit buffers.
+ *
+ * The UART data register is double buffered, so up to two bytes are written:
+ * the first one moves into the shift register right away if that was empty.
+ * While the priority lane is empty, bytes are only taken up to the end of the
+ * buffer memory; the rest follows on the next call.
+ *
+ * The TXC flag is cleared with every byte written to the UART, so it is only set
+ * when the UART ran out of data.
+ */
+void uart0_poll () {
+  uint8_t temp_tail, span, sent;
+
+  while (!ring_empty (uart0_prio_buffer)) {
+    // Priority frames waiting; select the lane byte by byte
+    if (!bit_is_set (UCSR0A, UDRE0)) {
+      return;
+    }
+    UCSR0A |= _BV(TXC0);
+    UDR0 = uart0_tx_next ();
+  }
+
+  span = ring_peek_span (uart0_tx_buffer);
+  temp_tail = uart0_tx_buffer.tail;
+  for (sent = 0; sent < span && bit_is_set (UCSR0A, UDRE0); sent++) {
+    // Clear TXC flag (used for Idle Frame management in comm_proto.c)
+    UCSR0A |= _BV(TXC0);
+    UDR0 = uart0_tx_buffer.buf[temp_tail + sent]; // Get byte from buffer
+  }
+  ring_skip (uart0_tx_buffer, sent);
+}
+
+/**
+ * Transmit a byte through UART 0.
  *
- * No buffering (the ATmega162 has a hardware FIFO of 3 bytes)
+ * This is a blocking routine. If the buffer is full, it will feed the UART
+ * itself until there is room again.
  *
- * @return -1 when receive buffer is empty
+ * The UART is fed right after placing the byte, so the line does not go idle
+ * while a frame is being produced.
  */
-int16_t uart0_get () {
-  uint8_t c;
+void uart0_put (const uint8_t c) {
+  while (ring_push (uart0_tx_buffer, c)) {
+    // Buffer is full
+    uart0_poll();
+  }
 
-  if (bit_is_clear (UCSR0A, RXC0)) {
-    // No data to be read
-    return -1;
+  uart0_poll();
+}
+
+/**
+ * Transmit n bytes through UART 0.
+ *
+ * Like uart0_put(), but all bytes are placed in the buffer at once. n should
+ * be smaller than UART0_TX_BUFSIZE.
+ */
+void uart0_write (const uint8_t src[], const uint8_t n) {
+  while (ring_push_n (uart0_tx_buffer, src, n)) {
+    // Not enough room in the buffer
+    uart0_poll();
   }
-  c = UDR0; // Get databyte
-  return c;
+
+  uart0_poll();
+}
+
+/**
+ * Transmit a complete frame of n bytes through UART 0 in the priority lane.
+ *
+ * The frame is sent at the next frame boundary of the data given to uart0_put()
+ * and uart0_write(). n should be smaller than UART0_PRIO_BUFSIZE.
+ */
+void uart0_write_prio (const uint8_t src[], const uint8_t n) {
+  while (ring_push_n (uart0_prio_buffer, src, n)) {
+    // Not enough room in the buffer
+    uart0_poll();
+  }
+
+  uart0_poll();
+}
+
+/**
+ * Check whether UART 0 has finished transmitting everything it was given.
+ *
+ * The TXC flag alone is not enough: it is only cleared when a byte is actually
+ * written to the UART, not when it is placed in the buffer.
+ */
+uint8_t uart0_tx_idle () {
+  return ring_empty (uart0_tx_buffer) && ring_empty (uart0_prio_buffer)
+    && bit_is_set (UCSR0A, TXC0);
+}
+
+#endif // UART0_TX_POLLED
+
+/**
+ * Number of bytes in the UART 0 transmit buffer
+ */
+uint8_t uart0_tx_used () {
+  return ring_used (uart0_tx_buffer);
+}
+
+#ifdef RING_HWM
+/**
+ * Read and reset the high-water mark of the UART 0 transmit buffer
+ */
+uint8_t uart0_tx_hwm () {
+  return ring_hwm_take (uart0_tx_buffer);
 }
+#endif
@@ -32,6 +32,13 @@
  */
 extern void uart_init ();
 
+/**
+ * Change the bit rate of UART 1, the daisy-chain
+ *
+ * ubrr: value for the UBRR1 register, F_CPU / (16 * baud) - 1
+ */
+extern void uart1_set_ubrr (const uint16_t ubrr);
+
 /**
  * Transmit a byte through UART 0.
  *
@@ -40,9 +47,59 @@ extern void uart_init ();
 extern void uart0_put (const uint8_t c);
 
 /**
- * Receive a byte through UART 0.
- * @return -1 when receive buffer is empty
+ * Transmit n bytes through UART 0.
+ *
+ * Like uart0_put(), but all bytes are placed in the buffer at once. n should
+ * be smaller than UART0_TX_BUFSIZE.
+ */
+extern void uart0_write (const uint8_t src[], const uint8_t n);
+
+/**
+ * Transmit a complete frame of n bytes through UART 0 in the priority lane.
+ *
+ * The frame is sent at the next frame boundary of the data given to uart0_put()
+ * and uart0_write(), ahead of anything still waiting in their buffer. n should
+ * be smaller than UART0_PRIO_BUFSIZE.
+ *
+ * Precondition: no frame is partially given to uart0_put() at the time of the
+ * call; the frame boundary is recognised by the frame start byte.
+ */
+extern void uart0_write_prio (const uint8_t src[], const uint8_t n);
+
+/**
+ * Check whether UART 0 has finished transmitting everything it was given.
+ *
+ * Returns non-zero when the transmit buffer is empty and the last byte has
+ * left the shift register.
+ */
+extern uint8_t uart0_tx_idle ();
+
+/**
+ * Number of bytes in the UART 0 transmit buffer
+ *
+ * Gauges the pressure on the link to the PC. The priority lane is not counted.
+ */
+extern uint8_t uart0_tx_used ();
+
+#ifdef UART0_TX_POLLED
+/**
+ * Feed UART 0 from the transmit buffer.
+ *
+ * Only present when UART0_TX_POLLED is defined. There is no transmit interrupt
+ * in that mode; this routine should be called often by the main loop. Every
+ * call fills the UART data register for as long as it is empty and there is
+ * data in the buffer.
+ */
+extern void uart0_poll ();
+#endif
+
+#ifdef RING_HWM
+/**
+ * Read and reset the high-water mark of the UART 0 transmit buffer
+ *
+ * Only present when RING_HWM is defined.
  */
-extern int16_t uart0_get ();
+extern uint8_t uart0_tx_hwm ();
+#endif
 
 #endif // ndef FILE_UART_H
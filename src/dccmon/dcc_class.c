@@ -0,0 +1,91 @@
+/**
+ * DCC packet classes
+ *
+ * Tells the kind of decoder a DCC packet is meant for, and it's address, from
+ * the first two bytes of the packet (NMRA S-9.2.1).
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include "dcc_receiver.h"
+#include "dcc_class.h"
+
+/**
+ * Non-zero after a reset packet, until a packet that can't be a service mode
+ * packet arrives
+ */
+static uint8_t service_mode;
+
+/**
+ * Classify a DCC packet, and give it's address
+ */
+uint8_t dcc_classify (const uint8_t packet[], const uint8_t len,
+    uint16_t *address) {
+  uint8_t first, second, class;
+
+  *address = 0;
+  if (dcc_too_short (len)) {
+    // No second byte to tell the class by
+    return DCC_CLASS_OTHER;
+  }
+  first = dcc_first_byte (packet, len);
+  second = dcc_second_byte (packet, len);
+
+  if (first == 0x00) {
+    // Broadcast
+    class = (second == 0x00) ? DCC_CLASS_RESET : DCC_CLASS_BROADCAST;
+  } else if (first == 0xFF) {
+    class = DCC_CLASS_IDLE;
+  } else if (first < 0x80) {
+    // 0AAAAAAA; 0111XXXX is also the instruction of a service mode packet
+    if (service_mode && first >= 0x70) {
+      class = DCC_CLASS_SERVICE;
+    } else {
+      class = DCC_CLASS_MF7;
+      *address = first;
+    }
+  } else if (first < 0xC0) {
+    // 10AAAAAA 1AAAXXXX, or 0AAA0AA1 for an extended accessory decoder. The
+    // upper address bits are sent inverted.
+    if (second & 0x80) {
+      class = DCC_CLASS_BASIC_ACC;
+      *address = (first & 0x3F) | ((uint16_t) (~second & 0x70) << 2);
+    } else {
+      // The two lower bits of the 11-bit address follow in the second byte
+      class = DCC_CLASS_EXT_ACC;
+      *address = ((uint16_t) (~second & 0x70) << 4)
+        | ((uint16_t) (first & 0x3F) << 2) | ((second >> 1) & 0x03);
+    }
+  } else if (first < 0xE8) {
+    // 11AAAAAA AAAAAAAA
+    class = DCC_CLASS_MF14;
+    *address = ((uint16_t) (first & 0x3F) << 8) | second;
+  } else {
+    class = DCC_CLASS_OTHER;
+  }
+
+  // Service mode starts with reset packets (NMRA S-9.2.3)
+  if (class == DCC_CLASS_RESET) {
+    service_mode = 1;
+  } else if (first < 0x70 || first >= 0x80) {
+    service_mode = 0;
+  }
+
+  return class;
+}
@@ -0,0 +1,59 @@
+/**
+ * DCC packet classes header file
+ *
+ * Defines the classes of DCC packets, as used by the filter rules and the
+ * summary.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_DCC_CLASS_H
+#define FILE_DCC_CLASS_H
+
+#include <stdint.h>
+
+/**
+ * Packet classes
+ *
+ * Only multi-function and accessory decoder packets have an address; the
+ * others have address 0.
+ */
+#define DCC_CLASS_MF7 0 // Multi-function decoder, 7-bit address
+#define DCC_CLASS_MF14 1 // Multi-function decoder, 14-bit address
+#define DCC_CLASS_BASIC_ACC 2 // Basic accessory decoder, 9-bit address
+#define DCC_CLASS_EXT_ACC 3 // Extended accessory decoder, 11-bit address
+#define DCC_CLASS_BROADCAST 4 // Broadcast, except reset
+#define DCC_CLASS_RESET 5 // Reset: 00 00 00
+#define DCC_CLASS_IDLE 6 // Idle: FF 00 FF
+#define DCC_CLASS_SERVICE 7 // Service mode, after a reset
+#define DCC_CLASS_OTHER 8 // Reserved first bytes
+#define DCC_CLASSES 9
+
+/**
+ * Classify DCC packet 'packet' of 'len' bytes, as returned by
+ * dcc_get_packet(), by it's first two bytes. A packet of a single byte is of
+ * class DCC_CLASS_OTHER.
+ *
+ * Returns the class, and stores the address in *address. Packets are taken to
+ * be service mode packets after a reset packet, so every packet received
+ * should be classified, in order.
+ */
+extern uint8_t dcc_classify (const uint8_t packet[], const uint8_t len,
+    uint16_t *address);
+
+#endif // ndef FILE_DCC_CLASS_H
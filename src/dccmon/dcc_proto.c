@@ -25,6 +25,16 @@
 #include "../common/comm_proto.h"
 #include "dcc_receiver.h"
 #include "dccmon.h"
+#include "dcc_shed.h"
+#ifdef DCC_VALIDATE
+#include "dcc_validate.h"
+#endif
+#ifdef DCC_TIMESTAMP
+#include "dcc_timestamp.h"
+#endif
+#ifdef DCC_SUMMARY
+#include "dcc_summary.h"
+#endif
 #include "dcc_proto.h"
 
 /**
@@ -33,6 +43,11 @@
  *
  * Only one frame is sent to the PC, even if more are available.
  *
+ * Under pressure, packets of little value are dropped by dcc_shed(). With
+ * DCC_IDLE_ELISION, idle packets are dropped and counted by dcc_elide(). In
+ * summary mode (DCC_SUMMARY), nothing is sent; dcc_summary_take() counts the
+ * packets instead.
+ *
  * Also checks for and reports overflows. If an overflow report is sent to the
  * PC, a data frame is sent as well to relieve pressure on the buffer.
  *
@@ -40,30 +55,50 @@
  */
 int8_t dcc_send() {
   int8_t retval;
+  uint8_t packet[DCC_MAX_PACKET];
   uint8_t dcc_length;
 
   retval = 0;
 
+#ifdef DCC_SUMMARY
+  if (dcc_summary_take (packet)) {
+    // Summary mode: packets and overflows are only counted
+    return 0;
+  }
+#endif
+
   // Check for overflow on DCC bus
   if (dcc_overflow_status()) {
     // Overflow
-    comm_start_frame (MANAG_PROTO); // Management protocol
-    comm_send_byte (MANAG_BUS_OVF); // Overflow of monitored bus
-    comm_end_frame ();
+    comm_send_manag_code (MANAG_BUS_OVF); // Overflow of monitored bus
     retval = 1;
   }
     
-  if (!dcc_would_block()) {
+  dcc_length = dcc_get_packet (packet);
+#ifdef DCC_IDLE_ELISION
+  if (dcc_length && dcc_elide (packet, dcc_length)) {
+    // Only counted
+    dcc_length = 0;
+  }
+#endif
+  if (dcc_length && !dcc_shed (packet, dcc_length)) {
     // We have a DCC packet to send
-    
-    dcc_length = dcc_get();
 
     // Send the frame
-    comm_start_frame (DCC_PROTO); // DCC protocol
-    for (; dcc_length > 0; dcc_length--) {
-      comm_send_byte (dcc_get());
-    }
-    comm_end_frame ();
+#ifdef DCC_WIRE_CAPTURE
+    comm_send_wire (packet, dcc_length);
+#elif defined(DCC_TIMESTAMP)
+    dcc_send_stamped (packet, dcc_length);
+#elif defined(DCC_DUAL_CHANNEL)
+    comm_send_frame_dict (dcc_packet_channel () ? DCC_CH1_PROTO : DCC_PROTO,
+        packet, dcc_length);
+#else
+    comm_send_frame_dict (DCC_PROTO, packet, dcc_length);
+#endif
+#if DCC_VALIDATE == 1
+    // Tell the PC when it failed validation
+    dcc_validate_flag ();
+#endif
     
     retval = 1;
   }
@@ -71,6 +106,27 @@ int8_t dcc_send() {
   return retval;
 }
 
+#ifdef DCC_SUMMARY
+/**
+ * Handle commands from the PC
+ *
+ * CMD_DCC_SUMMARY switches summary mode on or off.
+ */
+uint8_t monitor_command (const uint8_t cmd[], const uint8_t len) {
+  switch (cmd[0]) {
+  case CMD_DCC_SUMMARY:
+    if (len != 2 || cmd[1] > 1) {
+      return CMD_BAD_ARGS;
+    }
+    dcc_summary_set (cmd[1]);
+    return CMD_OK;
+
+  default:
+    return CMD_UNKNOWN;
+  }
+}
+#endif
+
 /**
  * monitor_send() is called by common/main.c to send out monitored data. It is
  * aliased to dcc_send().
@@ -6,6 +6,13 @@
  * filtering and interpreting the DCC frames. DCC frames are made available
  * through a circular buffer.
  *
+ * With DCC_EDGE_RECEIVER, the pin is not sampled; instead, an interrupt on
+ * every edge of the signal timestamps it, and the pulses are classified by the
+ * time between the edges. With DCC_ASM_SAMPLER, the sampling interrupt is
+ * written in assembly and keeps it's state in reserved registers. With
+ * DCC_DUAL_CHANNEL, two input pins are sampled in the same interrupt, and
+ * filtered together with logical operations across the bits of the port.
+ *
  * This file is part of DCC Monitor.
  *
  * Copyright 2007, 2008 Peter Lebbing <peter@digitalbrains.com>
@@ -32,29 +39,93 @@
 #include <inttypes.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/pgmspace.h>
 #include "../common/global.h"
 #include "../common/timer.h"
+#include "../common/ring.h"
+#include "../common/rtc.h"
 #include "dcc_receiver.h"
 #include "dccmon.h"
+#include "dcc_shed.h"
+#ifdef MEASURE_JITTER
+#include "../common/jitter.h"
+#endif
+#ifdef DCC_STATS
+#include "dcc_stats.h"
+#endif
+#ifdef DCC_VALIDATE
+#include "dcc_validate.h"
+#endif
+#ifdef DCC_SUMMARY
+#include "dcc_summary.h"
+#endif
 
-static struct {
-  volatile uint8_t buf[DCC_BUFSIZE];
-  volatile uint8_t head, tail;
-} dcc_buf; // Circular buffer holding DCC data
+/**
+ * Reception state of a DCC input
+ *
+ * buf is the circular buffer holding the DCC data. Every packet is stored as a
+ * length byte followed by the packet bytes. With DCC_PACKET_TIME, the time of
+ * the end bit is stored between them, high byte first.
+ *
+ * The other members belong to dcc_half_bit().
+ */
+struct dcc_channel {
+  RING(DCC_BUFSIZE) buf;
+  uint8_t byte_store; // Counting bits in preamble and storing databyte during reception
+  uint8_t write_pos; // Location in buf to write databyte
+  uint8_t state; // Current reception state
+#ifdef DCC_STATS
+  uint8_t preamble_bits; // Length of the preamble so far
+#endif
+#ifdef DCC_VALIDATE
+  uint8_t packet_xor; // XOR of the bytes received so far
+  uint8_t packet_len; // Number of bytes received so far
+#endif
+#ifdef DCC_WIRE_CAPTURE
+  uint8_t wire_hi; // Hi-bits of the frame, like hi_bits in comm_proto.c
+  uint8_t wire_parity; // Parity of the frame
+#endif
+};
 
-#define DCC_OVERFLOW_VAR global_prot_var
-#define DCC_OVERFLOW_BIT (1 << 1)
+/**
+ * The DCC inputs; with DCC_DUAL_CHANNEL, channel 1 is DCC_INPUT_PIN2
+ */
+static struct dcc_channel channels[DCC_CHANNELS];
+
+#ifdef DCC_DUAL_CHANNEL
+#if defined(DCC_EDGE_RECEIVER) || defined(DCC_ASM_SAMPLER)
+#error DCC_DUAL_CHANNEL needs the sampler in C
+#endif
+#if defined(DCC_STATS) || defined(DCC_WIRE_CAPTURE) || defined(DCC_TIMESTAMP)
+#error DCC_DUAL_CHANNEL can not be combined with DCC_STATS, DCC_WIRE_CAPTURE or DCC_TIMESTAMP
+#endif
 
 /**
- * Check if buffer has data available
+ * Channel of the packet last returned by dcc_get_packet()
  */
-uint8_t dcc_would_block () {
-  if (dcc_buf.head == dcc_buf.tail) {
-    // Yes, it would block
-    return true;
-  }
-  return false;
-}
+static uint8_t packet_channel;
+#endif
+
+#if defined(DCC_TIMESTAMP) && defined(DCC_WIRE_CAPTURE)
+#error DCC_TIMESTAMP can not be combined with DCC_WIRE_CAPTURE
+#endif
+
+#ifdef DCC_PACKET_TIME
+/**
+ * Time (lower 16 bits) of the packet last returned by dcc_get_packet()
+ */
+static uint16_t packet_time;
+#endif
+
+#if DCC_VALIDATE == 1
+/**
+ * Error class of the packet last returned by dcc_get_packet()
+ */
+static uint8_t packet_error;
+#endif
+
+#define DCC_OVERFLOW_VAR global_prot_var
+#define DCC_OVERFLOW_BIT (1 << 1)
 
 /**
  * Report and clear whether an overflow has occured
@@ -75,27 +146,217 @@ uint8_t dcc_overflow_status () {
 }
 
 /**
- * Return a byte of data from the circular buffer, blocking for new data if 
- * necessary.
+ * Get the next DCC packet from the circular buffer, if available.
+ *
+ * The packet is copied into packet[], which should be DCC_MAX_PACKET bytes
+ * big. Returns the length of the packet, or 0 when no packet is available.
+ *
+ * Only complete packets are pushed out by the interrupt handler, so the packet
+ * can be copied in one go.
+ */
+uint8_t dcc_get_packet (uint8_t packet[]) {
+  struct dcc_channel *ch;
+  uint8_t len;
+
+#ifdef DCC_DUAL_CHANNEL
+  // Take turns, so a busy channel can not starve the other
+  ch = &channels[packet_channel ^ 1];
+  if (ring_empty (ch->buf)) {
+    ch = &channels[packet_channel];
+    if (ring_empty (ch->buf)) {
+      return 0;
+    }
+  } else {
+    packet_channel ^= 1;
+  }
+#else
+  ch = &channels[0];
+  if (ring_empty (ch->buf)) {
+    return 0;
+  }
+#endif
+
+  len = ring_pop (ch->buf);
+#if DCC_VALIDATE == 1
+  // The error class is flagged in the length byte
+  packet_error = len >> DCC_ERR_SHIFT;
+  len &= (1 << DCC_ERR_SHIFT) - 1;
+#endif
+#ifdef DCC_PACKET_TIME
+  packet_time = ring_pop (ch->buf) << 8;
+  packet_time |= ring_pop (ch->buf);
+#endif
+  ring_pop_n (ch->buf, packet, len);
+  return len;
+}
+
+#ifdef DCC_PACKET_TIME
+/**
+ * RTC time of the end bit of the packet last returned by dcc_get_packet()
+ */
+uint32_t dcc_packet_time () {
+  uint32_t now, time;
+
+  // Extend the time of the packet to 32 bits; it is less than a wrap old
+  now = rtc_now ();
+  time = (now & 0xFFFF0000UL) | packet_time;
+  if (time > now) {
+    time -= 0x10000UL;
+  }
+  return time;
+}
+#endif
+
+#ifdef DCC_DUAL_CHANNEL
+/**
+ * Channel of the packet last returned by dcc_get_packet()
+ */
+uint8_t dcc_packet_channel () {
+  return packet_channel;
+}
+#endif
+
+#if DCC_VALIDATE == 1
+/**
+ * Error class of the packet last returned by dcc_get_packet(), or 0
+ */
+uint8_t dcc_packet_error () {
+  return packet_error;
+}
+#endif
+
+/**
+ * Number of bytes in the DCC buffer, to gauge the pressure on it. With
+ * DCC_DUAL_CHANNEL, that of the fullest buffer.
+ */
+uint8_t dcc_buffer_used () {
+#ifdef DCC_DUAL_CHANNEL
+  uint8_t used0, used1;
+
+  used0 = ring_used (channels[0].buf);
+  used1 = ring_used (channels[1].buf);
+  return (used0 > used1) ? used0 : used1;
+#else
+  return ring_used (channels[0].buf);
+#endif
+}
+
+#ifdef RING_HWM
+/**
+ * Read and reset the high-water mark of the DCC buffer, or the highest of
+ * both with DCC_DUAL_CHANNEL
+ */
+uint8_t monitor_hwm () {
+#ifdef DCC_DUAL_CHANNEL
+  uint8_t hwm0, hwm1;
+
+  hwm0 = ring_hwm_take (channels[0].buf);
+  hwm1 = ring_hwm_take (channels[1].buf);
+  return (hwm0 > hwm1) ? hwm0 : hwm1;
+#else
+  return ring_hwm_take (channels[0].buf);
+#endif
+}
+#endif
+
+#ifdef DCC_EDGE_RECEIVER
+#if DCC_INPUT_PIN != 3
+#error DCC_EDGE_RECEIVER needs the DCC input on INT1 (PD3)
+#endif
+
+/**
+ * EDGE_PRESCALE: prescaler of Timer3, which runs freely to timestamp the edges
+ * of the DCC signal. One tick is 0.72 uS at 11.0592 MHz, and the timer wraps
+ * after 47 ms, well beyond the longest stretched half 0-bit of 9900 uS.
  */
-uint8_t dcc_get () {
-  uint8_t temp, c;
+#define EDGE_PRESCALE 8
 
-  temp = dcc_buf.tail;
-  while (dcc_buf.head == temp) {} // Buffer is empty
+/**
+ * Number of Timer3 ticks in us microseconds
+ */
+#define edge_ticks(us) (div_round ((us) * F_CPU, EDGE_PRESCALE * 1000000ULL))
+
+/**
+ * Number of Timer3 ticks in us microseconds, rounded down, for the statistics
+ */
+#define edge_ticks_down(us) ((us) * F_CPU / (EDGE_PRESCALE * 1000000ULL))
+
+/**
+ * EDGE_DISCRIMINATOR: DCC pulses shorter than this many ticks are interpreted
+ * as (half) a 1-bit, longer ones as (half) a 0-bit. The threshold is 77 uS,
+ * like with sampling, but without the rounding to whole samples.
+ */
+#define EDGE_DISCRIMINATOR (edge_ticks (77ULL))
+
+/**
+ * EDGE_GLITCH: pulses shorter than this many ticks are spikes, and are
+ * removed from the signal. The shortest valid pulse is 52 uS.
+ */
+#define EDGE_GLITCH (edge_ticks (20ULL))
+
+/**
+ * Initialise DCC receiver
+ *
+ * Sets the I/O-pin correctly, starts Timer3 and enables the interrupt on the
+ * edges of INT1. Also starts load-shedding (dcc_shed.c), and the reports and
+ * summary when built in.
+ */
+void dcc_init () {
+  // Set DCC input pin to be input
+  DCC_INPUT_DDR &= ~(_BV(DCC_INPUT_PIN));
+  // Disable pullup
+  DCC_INPUT_PORT &= ~(_BV(DCC_INPUT_PIN));
+  // Let Timer3 run freely to timestamp the edges
+  TCCR3B = _BV(CS31); // Prescaler /8, normal mode, start!
+  // Any logical change on INT1 generates an interrupt
+  MCUCR = (MCUCR & ~(_BV(ISC11))) | _BV(ISC10);
+  GIFR = _BV(INTF1); // Clear INT1 interrupt flag
+  GICR |= _BV(INT1); // Enable INT1
 
-  c = dcc_buf.buf[temp];
-  circ_buf_incr_ptr (&temp, DCC_BUFSIZE);
-  dcc_buf.tail = temp;
-  return c;
+  dcc_shed_init();
+#ifdef DCC_STATS
+  dcc_stats_init();
+#endif
+#if DCC_VALIDATE == 3
+  dcc_validate_init();
+#endif
+#ifdef DCC_SUMMARY
+  dcc_summary_init();
+#endif
 }
+#else
+#ifdef DCC_ASM_SAMPLER
+#ifdef MEASURE_JITTER
+#error MEASURE_JITTER does not measure the assembly sampler
+#endif
+#ifdef DCC_STATS
+#error DCC_STATS needs the durations the assembly sampler does not count
+#endif
+
+/**
+ * State of the assembly sampler, in registers reserved for it in the whole
+ * firmware with -ffixed-r2 up to -ffixed-r5 (see Makefile). Compared to the
+ * C version, hi_count and pulse_duration are biased, so their thresholds are
+ * reached at 0 and can be tested without the high registers cpi needs.
+ */
+// Shiftregister with latest unfiltered pinstates
+register uint8_t asm_pulses asm ("r2");
+// Number of 1-bits in pulses, minus 3
+register uint8_t asm_hi_count asm ("r3");
+// Duration of the filtered signal, minus PULSE_DISCRIMINATOR - 1
+register uint8_t asm_duration asm ("r4");
+// r5 holds SREG during the interrupt
+#endif
 
 /**
  * TICKS_PER_SAMPLE: The number of clockticks that comes closes to a 10 uS
  * period. We sample the DCC input pin at 100 kHz, or equivalently, every
  * TICKS_PER_SAMPLE clockticks.
+ *
+ * The rounding is written out instead of using div_round(), so the
+ * preprocessor can check with it.
  */
-#define TICKS_PER_SAMPLE (div_round (F_CPU, 100000UL))
+#define TICKS_PER_SAMPLE ((F_CPU + 50000UL) / 100000UL)
 
 /*
  * PULSE_DISCRIMINATOR: DCC Pulses which last this many samples or more are
@@ -108,10 +369,48 @@ uint8_t dcc_get () {
  */
 #define PULSE_DISCRIMINATOR (div_round (77ULL * F_CPU, TICKS_PER_SAMPLE * 1000000ULL))
 
+/**
+ * PULSE_MAX: pulse_duration stops counting here, to prevent overflow. With
+ * DCC_STATS, the durations are counted up to 1 ms for the histogram.
+ */
+#ifdef DCC_STATS
+#define PULSE_MAX 100
+#else
+#define PULSE_MAX (PULSE_DISCRIMINATOR - 1)
+#endif
+
+/**
+ * Number of samples in us microseconds, rounded down
+ *
+ * A pulse of T us spans f(T) or f(T) + 1 samples, depending on it's phase to
+ * the sampling; stats_half_bucket() gets a quantization of 1.
+ */
+#define us_samples(us) ((us) * F_CPU / (TICKS_PER_SAMPLE * 1000000ULL))
+
+#ifdef DCC_STATS
+/*
+ * Check that the half-bits of a command station meeting the NMRA timing are
+ * counted in spec, at both sample counts they can be measured as: the nominal
+ * 58 and 100 us, and the limits of 52, 64 and 90 us.
+ */
+#define sampled_in_spec(us) \
+  (!stats_half_out_of_spec (stats_half_bucket (us_samples (us), \
+       us_samples, 1)) \
+   && !stats_half_out_of_spec (stats_half_bucket (us_samples (us) + 1, \
+       us_samples, 1)))
+#if !sampled_in_spec (58ULL) || !sampled_in_spec (100ULL) \
+  || !sampled_in_spec (52ULL) || !sampled_in_spec (64ULL) \
+  || !sampled_in_spec (90ULL)
+#error DCC_STATS counts half-bits in spec as out of spec at this F_CPU
+#endif
+#endif
+
 /**
  * Initialise DCC receiver
  *
- * Sets the I/O-pin correctly and starts the interrupt-driven sampler. 
+ * Sets the I/O-pin correctly and starts the interrupt-driven sampler. Also
+ * starts load-shedding (dcc_shed.c), and the reports and summary when built
+ * in.
  *
  * It is assumed the uC is in it's default settings with regard to periphery.
  * The DDR register is only explicitly programmed to reduce the chance of a
@@ -122,11 +421,35 @@ void dcc_init () {
   DCC_INPUT_DDR &= ~(_BV(DCC_INPUT_PIN));
   // Disable pullup
   DCC_INPUT_PORT &= ~(_BV(DCC_INPUT_PIN));
+#ifdef DCC_DUAL_CHANNEL
+  // Same for the second input
+  DCC_INPUT_DDR &= ~(_BV(DCC_INPUT_PIN2));
+  DCC_INPUT_PORT &= ~(_BV(DCC_INPUT_PIN2));
+#endif
   // Configure Timer0 to generate an interrupt every 10 uS
   OCR0 = timer0_period (TICKS_PER_SAMPLE, TICKS_PER_SAMPLE) - 1;
   TIMSK |= _BV(OCIE0); // Enable Compare Match interrupt
   TCCR0 = _BV(WGM01) | timer0_prescale_bits (TICKS_PER_SAMPLE); // CTC mode, start!
+
+#ifdef DCC_ASM_SAMPLER
+  // The registers are not cleared by the startup code
+  asm_pulses = 0;
+  asm_hi_count = (uint8_t) -3;
+  asm_duration = (uint8_t) (1 - PULSE_DISCRIMINATOR);
+#endif
+
+  dcc_shed_init();
+#ifdef DCC_STATS
+  dcc_stats_init();
+#endif
+#if DCC_VALIDATE == 3
+  dcc_validate_init();
+#endif
+#ifdef DCC_SUMMARY
+  dcc_summary_init();
+#endif
 }
+#endif
 
 /**
  * monitor_init() is called by common/main.c to initialize the monitor running
@@ -135,6 +458,622 @@ void dcc_init () {
  */
 void monitor_init() __attribute__ ((weak,alias("dcc_init")));
 
+#ifdef DCC_WIRE_CAPTURE
+/**
+ * Frame start byte of the DCC frames: address 0, DCC_PROTO, MSB set
+ */
+#define WIRE_START ((1 << 7) | DCC_PROTO)
+
+/**
+ * Store a byte of the frame being received on channel ch at it's write_pos and
+ * count it in the length
+ *
+ * Encoding the packet as it is received spreads the work of the 7-in-8 coding
+ * over the sampling interrupts, one byte at a time, instead of doing it for a
+ * whole packet in the main loop, which is the bottleneck under bursts of
+ * packets. The main loop only copies the finished frame to the UART.
+ *
+ * Returns zero when the buffer is full; the byte is not stored.
+ */
+static inline uint8_t wire_put (struct dcc_channel *const,
+    const uint8_t) __attribute__ ((always_inline));
+static inline uint8_t wire_put (struct dcc_channel *const ch, const uint8_t c) {
+  if (ch->write_pos == ch->buf.tail) {
+    return 0;
+  }
+  ch->buf.buf[ch->write_pos] = c;
+  ch->write_pos = ring_next (ch->buf, ch->write_pos);
+  ch->buf.buf[ch->buf.head]++;
+  return 1;
+}
+#endif
+
+/**
+ * Reception states
+ *
+ * Every part of a DCC packet has three states: the first half of a bit is
+ * expected (STATE_FIRST), or the second half, after a first half that was
+ * half of a 1-bit (STATE_AFTER_1) or half of a 0-bit (STATE_AFTER_0).
+ */
+#define STATE_FIRST 0
+#define STATE_AFTER_1 1
+#define STATE_AFTER_0 2
+#define PREAMBLE 0 // Preamble bits expected
+#define LEAD0 3 // Leading 0 expected (follows preamble)
+#define IN_BYTE 6 // Reading a byte
+#define TRAILER 9 // Trailer bit expected (follows a byte)
+
+/**
+ * Actions taken on a transition, besides changing the state
+ */
+#define ACT_NONE (0 << 4)
+#define ACT_RESTART (1 << 4) // Invalid bit, restart everything
+#define ACT_PREAMBLE (2 << 4) // Count a preamble bit
+#define ACT_START (3 << 4) // Start a packet
+#define ACT_BIT (4 << 4) // Shift in a databit
+#define ACT_END (5 << 4) // End of the packet, push it out
+#define ACT_NEXT_BYTE (6 << 4) // Another byte follows
+
+/**
+ * State transitions
+ *
+ * Indexed by the state times two, plus one for half of a 1-bit. The lower
+ * nibble holds the next state, the upper the action. An action can still
+ * override the next state.
+ *
+ * An invalid bit restarts everything, taking it's second half as a first half
+ * in the preamble. There is one special case: half of a 1 followed by half of
+ * a 0 while waiting for the leading 0. So far, we had only 1's, but if we
+ * caught what was the second half of such a 1 as the first half accidentally,
+ * we end up here even though the waveform is acceptable. Next is the second
+ * half of the leading 0.
+ *
+ * The 1-bits while waiting for the leading 0 are counted as preamble bits too,
+ * for the statistics.
+ */
+static const uint8_t transitions[24] PROGMEM = {
+  // PREAMBLE
+  PREAMBLE + STATE_AFTER_0, PREAMBLE + STATE_AFTER_1,
+  PREAMBLE + STATE_AFTER_0 + ACT_RESTART, PREAMBLE + STATE_FIRST + ACT_PREAMBLE,
+  PREAMBLE + STATE_AFTER_0 + ACT_RESTART, PREAMBLE + STATE_AFTER_1 + ACT_RESTART,
+  // LEAD0
+  LEAD0 + STATE_AFTER_0, LEAD0 + STATE_AFTER_1,
+  LEAD0 + STATE_AFTER_0, LEAD0 + STATE_FIRST + ACT_PREAMBLE,
+  IN_BYTE + STATE_FIRST + ACT_START, PREAMBLE + STATE_AFTER_1 + ACT_RESTART,
+  // IN_BYTE
+  IN_BYTE + STATE_AFTER_0, IN_BYTE + STATE_AFTER_1,
+  PREAMBLE + STATE_AFTER_0 + ACT_RESTART, IN_BYTE + STATE_FIRST + ACT_BIT,
+  IN_BYTE + STATE_FIRST + ACT_BIT, PREAMBLE + STATE_AFTER_1 + ACT_RESTART,
+  // TRAILER
+  TRAILER + STATE_AFTER_0, TRAILER + STATE_AFTER_1,
+  PREAMBLE + STATE_AFTER_0 + ACT_RESTART, PREAMBLE + STATE_FIRST + ACT_END,
+  IN_BYTE + STATE_FIRST + ACT_NEXT_BYTE, PREAMBLE + STATE_AFTER_1 + ACT_RESTART
+};
+
+/**
+ * Parse incoming DCC data, one half-bit at a time, placing it in the buffer.
+ * Called by the interrupt handler on every edge of the DCC signal of channel
+ * ch, with one non-zero when the pulse that just ended was half of a 1-bit,
+ * and zero when it was half of a 0-bit. With a single input, the channel is a
+ * constant, so the routine inlines to the same code as with a single set of
+ * static variables. With DCC_DUAL_CHANNEL, the sampler picks the channel at
+ * run time, and it's one inlined copy reaches the state through the pointer.
+ *
+ * This routine is a finite state machine with the state recording the
+ * position in the DCC signal. The transitions are looked up in a table, so
+ * every half-bit takes the same path up to the action; only the actions on
+ * completed bits that handle data are code. Most half-bits have no action.
+ *
+ * A local buffer pointer (write_pos) is used that points to the location
+ * to write the next DCC databyte. Only when a full frame is received, is
+ * the buffer head pointer updated to push the frame out to the listener.
+ * The length of the packet is recorded before the data bytes.
+ *
+ * With DCC_WIRE_CAPTURE, the packet is stored as a complete Communication
+ * protocol frame instead, see wire_put().
+ *
+ * With DCC_PACKET_TIME, two positions after the length are left free, and the
+ * Timer1 RTC is stored there at the end bit.
+ *
+ * With DCC_VALIDATE, the XOR and the number of the bytes are kept as the bytes
+ * complete, and a bad packet is flagged in it's length byte or dropped at the
+ * end bit (see dcc_validate.h).
+ */
+static inline void dcc_half_bit (struct dcc_channel *const,
+    const uint8_t) __attribute__ ((always_inline));
+static inline void dcc_half_bit (struct dcc_channel *const ch,
+    const uint8_t one) {
+#ifdef DCC_WIRE_CAPTURE
+  uint8_t temp_hi;
+#endif
+#if !defined(DCC_WIRE_CAPTURE) || defined(DCC_PACKET_TIME)
+  uint8_t temp_pos;
+#endif
+  uint8_t entry, temp_data;
+#ifdef DCC_PACKET_TIME
+  uint16_t stamp;
+#endif
+
+  entry = pgm_read_byte (&transitions[(ch->state << 1) | (one ? 1 : 0)]);
+  ch->state = entry & 15;
+
+  switch (entry & (7 << 4)) {
+  case ACT_NONE:
+    return;
+
+  case ACT_RESTART:
+    ch->byte_store = 0;
+#ifdef DCC_STATS
+    ch->preamble_bits = 0;
+#endif
+    return;
+
+  case ACT_PREAMBLE:
+    // We received a 1 in the preamble
+#ifdef DCC_STATS
+    if (ch->preamble_bits != UINT8_MAX) {
+      ch->preamble_bits++;
+    }
+#endif
+    if (ch->byte_store >= 9) {
+      // We've received 10 preamble bits
+      // Wait for a leading 0
+      ch->state = LEAD0 + STATE_FIRST;
+    } else {
+      ch->byte_store++; // Count 1-bits here
+    }
+    return;
+
+  case ACT_START:
+    // We received the leading 0, next should be a byte
+#ifdef DCC_STATS
+    stats_record_start (ch->preamble_bits);
+    ch->preamble_bits = 0;
+#endif
+    temp_data = ch->buf.head;
+
+    // Initialise packet length
+    ch->buf.buf[temp_data] = 0;
+    // Set write_pos to the byte following the length
+    ch->write_pos = ring_next (ch->buf, temp_data);
+#ifdef DCC_PACKET_TIME
+    // Leave room for the timestamp
+    if (ch->write_pos == ch->buf.tail
+        || ring_next (ch->buf, ch->write_pos) == ch->buf.tail) {
+      // Overflow! Discard this packet
+      DCC_OVERFLOW_VAR |= DCC_OVERFLOW_BIT;
+      ch->state = PREAMBLE + STATE_FIRST;
+      ch->byte_store = 0;
+      return;
+    }
+    ch->write_pos = ring_next (ch->buf, ring_next (ch->buf, ch->write_pos));
+#endif
+#ifdef DCC_WIRE_CAPTURE
+    if (!wire_put (ch, WIRE_START)) {
+      // Overflow! Discard this packet
+      DCC_OVERFLOW_VAR |= DCC_OVERFLOW_BIT;
+      ch->state = PREAMBLE + STATE_FIRST;
+      ch->byte_store = 0;
+      return;
+    }
+    ch->wire_parity = WIRE_START;
+    ch->wire_hi = (1 << 7); // The bit is used to see when 7 bytes have been stored
+#endif
+#ifdef DCC_VALIDATE
+    ch->packet_xor = 0;
+    ch->packet_len = 0;
+#endif
+    ch->byte_store = 1; // This bit is used to see when we received a full byte
+    return;
+
+  case ACT_BIT:
+    // Shift in a bit
+    temp_data = ch->byte_store << 1;
+    if (one) {
+      temp_data |= 1;
+    }
+
+    if (!(ch->byte_store & (1<<7))) {
+      // Not the last bit in the byte
+      ch->byte_store = temp_data;
+      return;
+    }
+
+    // Last bit in the byte
+#ifdef DCC_VALIDATE
+    ch->packet_xor ^= temp_data;
+    ch->packet_len++;
+#endif
+#ifdef DCC_WIRE_CAPTURE
+    // Store the MSB-stripped byte, and the hi-bits after every 7 bytes
+    ch->wire_parity ^= temp_data;
+    temp_hi = (ch->wire_hi >> 1) | (temp_data & (1 << 7));
+    if (!wire_put (ch, temp_data & 127)
+        || ((temp_hi & 1) && !wire_put (ch, temp_hi >> 1))) {
+      // Overflow! Discard this packet
+      DCC_OVERFLOW_VAR |= DCC_OVERFLOW_BIT;
+      ch->state = PREAMBLE + STATE_FIRST;
+      ch->byte_store = 0;
+      return;
+    }
+    if (temp_hi & 1) {
+      ch->wire_parity ^= temp_hi >> 1;
+      temp_hi = (1 << 7);
+    }
+    ch->wire_hi = temp_hi;
+#else
+    // Check whether we have space to store it in the buffer
+    temp_pos = ch->write_pos;
+    if (ch->write_pos == ch->buf.tail) {
+      // Overflow! Discard this packet
+      DCC_OVERFLOW_VAR |= DCC_OVERFLOW_BIT;
+      ch->state = PREAMBLE + STATE_FIRST;
+      ch->byte_store = 0;
+      return;
+    }
+
+    // Store it in the buffer
+    ch->buf.buf[temp_pos] = temp_data;
+
+    // Increase writing position in buffer
+    ch->write_pos = ring_next (ch->buf, temp_pos);
+
+    // Increase packet length
+    ch->buf.buf[ch->buf.head]++;
+#endif
+
+    // Next is the trailer bit
+    ch->state = TRAILER + STATE_FIRST;
+    return;
+
+  case ACT_END:
+    // This is the end of the DCC message
+#ifdef DCC_PACKET_TIME
+    stamp = TCNT1;
+#endif
+    // During byte reception, we allowed the buffer to go completely full
+    // This is not allowed now, because that state is indiscernable from completely empty
+
+#ifdef DCC_VALIDATE
+    // Check the length and the error detection byte
+    temp_data = (ch->packet_len < DCC_MIN_LEN) ? DCC_ERR_SHORT
+      : (ch->packet_len > DCC_MAX_LEN) ? DCC_ERR_LONG
+      : ch->packet_xor ? DCC_ERR_CHECKSUM : 0;
+#if DCC_VALIDATE >= 2
+    if (temp_data) {
+      // Discard the bad packet
+#if DCC_VALIDATE == 3
+      validate_count (temp_data);
+#endif
+#ifdef DCC_STATS
+      stats_record_end ();
+#endif
+      ch->byte_store = 0;
+      return;
+    }
+#endif
+#endif
+
+#ifdef DCC_WIRE_CAPTURE
+    // Finish the frame: remaining hi-bits and the parity byte
+    temp_hi = ch->wire_hi;
+    if (temp_hi != (1 << 7)) {
+      // Shift the bits into position
+      while (!(temp_hi & 1)) {
+        temp_hi >>= 1;
+      }
+      temp_hi >>= 1; // Shift out the bit used to count stored bytes
+      ch->wire_parity ^= temp_hi;
+    }
+
+    if ((temp_hi != (1 << 7) && !wire_put (ch, temp_hi))
+        || !wire_put (ch, ch->wire_parity & 127)
+        || ch->write_pos == ch->buf.tail) {
+#else
+    if (ch->write_pos == ch->buf.tail) {
+#endif
+      // Overflow!
+      DCC_OVERFLOW_VAR |= DCC_OVERFLOW_BIT;
+    } else {
+#if DCC_VALIDATE == 1
+      // Flag a bad packet in it's length byte
+      ch->buf.buf[ch->buf.head] |= temp_data << DCC_ERR_SHIFT;
+#endif
+#ifdef DCC_PACKET_TIME
+      // Store the time of the end bit after the length byte
+      temp_pos = ring_next (ch->buf, ch->buf.head);
+      ch->buf.buf[temp_pos] = stamp >> 8;
+      ch->buf.buf[ring_next (ch->buf, temp_pos)] = stamp & 0xff;
+#endif
+      // Accept the message in the buffer
+      ring_commit (ch->buf, ch->write_pos);
+    }
+#ifdef DCC_STATS
+    stats_record_end ();
+#endif
+
+    ch->byte_store = 0;
+    return;
+
+  default: // ACT_NEXT_BYTE
+#if DCC_VALIDATE >= 2
+    if (ch->packet_len >= DCC_MAX_LEN) {
+      // Too long; discard it now instead of filling the buffer with it
+#if DCC_VALIDATE == 3
+      validate_count (DCC_ERR_LONG);
+#endif
+      ch->state = PREAMBLE + STATE_FIRST;
+      ch->byte_store = 0;
+      return;
+    }
+#endif
+    // Another byte to come
+    ch->byte_store = 1; // This bit is used to see when we've got a full byte
+    return;
+  }
+}
+
+#ifdef DCC_EDGE_RECEIVER
+/**
+ * Timestamp an edge of the DCC signal and classify the pulse before it.
+ * This gets called on every edge, about 17000 times per second at most.
+ *
+ * A pulse is only classified at the edge after the one ending it: when that
+ * edge follows within EDGE_GLITCH, the two edges are a spike, and they are
+ * both dropped so the pulse simply continues. When both edges of a spike have
+ * passed before the interrupt is handled, the level is unchanged, and the
+ * interrupt is ignored.
+ */
+ISR(INT1_vect) {
+  static uint16_t pulse_start; // Start of the pulse in progress
+  static uint16_t pulse_end; // Last edge, the end of that pulse unless a spike follows
+  static uint8_t have_end; // Non-zero when pulse_end is valid
+  static uint8_t level; // Level of the signal after the last edge
+  uint16_t now;
+  uint8_t pin;
+
+  now = TCNT3;
+  pin = DCC_INPUT_PORT & _BV(DCC_INPUT_PIN);
+
+  if (pin == level) {
+    // No change after all
+    return;
+  }
+  level = pin;
+
+  if (have_end) {
+    if ((uint16_t) (now - pulse_end) < EDGE_GLITCH) {
+      // A spike; the pulse continues
+      have_end = 0;
+      return;
+    }
+
+    // The last edge really ended the pulse
+#ifdef DCC_STATS
+    stats_record_half (stats_half_bucket ((uint16_t) (pulse_end - pulse_start),
+          edge_ticks_down, 1));
+#endif
+    dcc_half_bit (&channels[0],
+        (uint16_t) (pulse_end - pulse_start) < EDGE_DISCRIMINATOR);
+    pulse_start = pulse_end;
+  }
+
+  pulse_end = now;
+  have_end = 1;
+}
+#elif defined(DCC_ASM_SAMPLER)
+/**
+ * Handle a filtered state change found by the assembly sampler
+ *
+ * Called from the interrupt handler, with the call-used registers saved.
+ */
+static void asm_sampler_edge () __attribute__ ((used, noinline));
+static void asm_sampler_edge () {
+  uint8_t one;
+
+  // Duration < 80.30 uS is half of a 1-bit, longer half of a 0-bit
+  one = (asm_duration != 0);
+  asm_duration = (uint8_t) (1 - PULSE_DISCRIMINATOR);
+  dcc_half_bit (&channels[0], one);
+}
+
+/**
+ * Sample the DCC input pin, in assembly
+ *
+ * Does the same as the C version below, without a prologue and epilogue: the
+ * state is kept in registers, and SREG is saved in one. When there is no
+ * filtered state change, which is by far the most common case, the handler
+ * takes about 25 cycles, from the interrupt request up to and including reti.
+ * On a state change, the call-used registers are saved and asm_sampler_edge()
+ * handles it.
+ */
+ISR(TIMER0_COMP_vect, ISR_NAKED) {
+  asm volatile (
+    "in r5, __SREG__" "\n\t"
+    // Shift in current puls
+    "lsl r2" "\n\t"
+    "sbic %[port], %[pin]" "\n\t"
+    "inc r2" "\n\t"
+    // Adjust hi_count and check filtered state change
+    "sbrs r2, 6" "\n\t"
+    "rjmp 1f" "\n\t"
+    "sbrc r2, 0" "\n\t"
+    "rjmp 2f" "\n\t"
+    // High-to-low when hi_count goes from 3 to 2
+    "tst r3" "\n\t"
+    "brne 5f" "\n\t"
+    "dec r3" "\n\t"
+    "rjmp 3f" "\n\t"
+    "5:" "\n\t"
+    "dec r3" "\n\t"
+    "rjmp 2f" "\n\t"
+    "1:" "\n\t"
+    "sbrs r2, 0" "\n\t"
+    "rjmp 2f" "\n\t"
+    // Low-to-high when hi_count goes from 2 to 3
+    "inc r3" "\n\t"
+    "breq 3f" "\n\t"
+    "2:" "\n\t"
+    // Nothing changes, only adjust duration; stop counting at the threshold
+    "tst r4" "\n\t"
+    "breq 4f" "\n\t"
+    "inc r4" "\n\t"
+    "4:" "\n\t"
+    "out __SREG__, r5" "\n\t"
+    "reti" "\n\t"
+    // Filtered state change
+    "3:" "\n\t"
+    "push r0" "\n\t"
+    "push r1" "\n\t"
+    "clr r1" "\n\t"
+    "push r18" "\n\t"
+    "push r19" "\n\t"
+    "push r20" "\n\t"
+    "push r21" "\n\t"
+    "push r22" "\n\t"
+    "push r23" "\n\t"
+    "push r24" "\n\t"
+    "push r25" "\n\t"
+    "push r26" "\n\t"
+    "push r27" "\n\t"
+    "push r30" "\n\t"
+    "push r31" "\n\t"
+    "call asm_sampler_edge" "\n\t"
+    "pop r31" "\n\t"
+    "pop r30" "\n\t"
+    "pop r27" "\n\t"
+    "pop r26" "\n\t"
+    "pop r25" "\n\t"
+    "pop r24" "\n\t"
+    "pop r23" "\n\t"
+    "pop r22" "\n\t"
+    "pop r21" "\n\t"
+    "pop r20" "\n\t"
+    "pop r19" "\n\t"
+    "pop r18" "\n\t"
+    "pop r1" "\n\t"
+    "pop r0" "\n\t"
+    "out __SREG__, r5" "\n\t"
+    "reti" "\n\t"
+    :: [port] "I" (_SFR_IO_ADDR (DCC_INPUT_PORT)), [pin] "I" (DCC_INPUT_PIN)
+  );
+}
+#elif defined(DCC_DUAL_CHANNEL)
+/**
+ * Port bits of the DCC inputs, the lanes of the bit-sliced sampler
+ */
+#define DCC_LANES (_BV(DCC_INPUT_PIN) | _BV(DCC_INPUT_PIN2))
+
+/**
+ * The durations count up to PULSE_DISCRIMINATOR - 1 in 3 bits. div_round()
+ * can't be used in #if, so it's rounding is written out here.
+ */
+#if (77ULL * F_CPU + TICKS_PER_SAMPLE * 500000ULL) \
+    / (TICKS_PER_SAMPLE * 1000000ULL) - 1 > 7
+#error DCC_DUAL_CHANNEL counts the pulse durations in 3 bits, too few at this F_CPU
+#endif
+
+/**
+ * Lanes of the bit-sliced 3-bit counter c0, c1, c2 holding the value n
+ */
+#define slice_equals(c0, c1, c2, n) (((n) & 1 ? (c0) : ~(c0)) \
+    & ((n) & 2 ? (c1) : ~(c1)) & ((n) & 4 ? (c2) : ~(c2)))
+
+/**
+ * Sample both DCC input pins and parse incoming DCC data, placing it in the
+ * buffer of each channel.
+ * This gets called approx. every 10 uS
+ *
+ * The filter and the pulse durations of the C version below are kept for all
+ * the inputs at once, bit-sliced: every input has a bit (it's lane) in the
+ * same position as it's pin on the port, and a counter is spread over several
+ * variables, one per bit of the count. A step of the counters of all inputs
+ * then takes a handful of logical operations, whatever the number of inputs.
+ *
+ * The filter counts the 1-bits among the last 6 samples. Instead of shifting
+ * every lane, the samples are kept in a ring of port readings, and the sample
+ * falling out of the window is compared with the one coming in. The filtered
+ * level is high with 3 or more 1-bits, like hi_count crossing 3 in the C
+ * version.
+ *
+ * The durations count up to PULSE_DISCRIMINATOR - 1 in 3 bits, which is
+ * enough for the 7 or 8 samples of 77 uS.
+ *
+ * At most one half-bit is decoded per interrupt, so the longest run of the
+ * interrupt is that of the single-input sampler plus the filter above. The
+ * half-bits are queued per lane, and the lanes take turns; when both inputs
+ * change in the same sample, one of them is decoded 10 uS late. A real
+ * half-bit lasts 5 samples or more, so a lane is never queued twice; with
+ * noise, the older half-bit is overwritten.
+ */
+ISR(TIMER0_COMP_vect) {
+  static uint8_t samples[6]; // Latest unfiltered port readings
+  static uint8_t sample_pos; // Position of the oldest reading in samples
+  static uint8_t hi0, hi1, hi2; // Bit-sliced count of 1-bits in samples
+  static uint8_t level; // Filtered level
+  static uint8_t dur0, dur1, dur2; // Bit-sliced duration of the filtered level
+  static uint8_t queued; // Lanes with a half-bit still to be decoded
+  static uint8_t queued_one; // Queued lanes whose half-bit is half of a 1-bit
+  static uint8_t turn = _BV(DCC_INPUT_PIN); // Lane to decode first
+  uint8_t now, inc, dec, carry, changed, saturated;
+
+#ifdef MEASURE_JITTER
+  // Timer0 runs at the CPU clock in CTC mode, so TCNT0 holds the number of
+  // clockticks since the compare match.
+  jitter_record (TCNT0, TIFR & _BV(OCF0));
+#endif
+
+  // Swap the current pinstates for the ones from 6 samples ago
+  now = DCC_INPUT_PORT & DCC_LANES;
+  inc = now & ~samples[sample_pos];
+  dec = samples[sample_pos] & ~now;
+  samples[sample_pos] = now;
+  sample_pos = (sample_pos == 5) ? 0 : sample_pos + 1;
+
+  // Count up the lanes in inc, and down the lanes in dec
+  carry = inc & hi0;
+  hi0 ^= inc;
+  hi1 ^= carry;
+  hi2 ^= carry & ~hi1; // hi1 overflowed when it just went 1 -> 0
+  carry = dec & ~hi0;
+  hi0 ^= dec;
+  hi1 ^= carry;
+  hi2 ^= carry & hi1; // hi1 borrowed when it just went 0 -> 1
+
+  // Filtered state changes: the count crossed 3
+  changed = level ^ (hi2 | (hi1 & hi0));
+  level ^= changed;
+
+  // Duration < 80.30 uS is half of a 1-bit, longer half of a 0-bit
+  saturated = slice_equals (dur0, dur1, dur2, PULSE_DISCRIMINATOR - 1);
+
+  // Restart the durations of the lanes that changed, and adjust the others.
+  // Stop counting to prevent overflow.
+  inc = ~(saturated | changed);
+  carry = inc & dur0;
+  dur0 ^= inc;
+  inc = carry & dur1;
+  dur1 ^= carry;
+  dur2 ^= inc;
+  dur0 &= ~changed;
+  dur1 &= ~changed;
+  dur2 &= ~changed;
+
+  // Queue the half-bits of the lanes that changed
+  queued_one = (queued_one & ~changed) | (changed & ~saturated);
+  queued |= changed;
+
+  if (queued) {
+    // Decode one of them, taking the lanes in turn
+    if (!(queued & turn)) {
+      turn ^= DCC_LANES;
+    }
+    queued &= ~turn;
+    dcc_half_bit (&channels[turn == _BV(DCC_INPUT_PIN2)], queued_one & turn);
+    turn ^= DCC_LANES;
+  }
+}
+#else
 /**
  * Sample the DCC input pin and parse incoming DCC data, placing it in the 
  * buffer.
@@ -148,28 +1087,18 @@ void monitor_init() __attribute__ ((weak,alias("dcc_init")));
  *
  * With a clock frequency of 11.0592 MHz, this means filtered durations up to
  * 80.30 uS get interpreted as (half) a 1. This is 8 samples.
- *
- * This routine is basically a finite state machine with the state
- * recording the position in the DCC signal.
- *
- * A local buffer pointer (write_pos) is used that points to the location
- * to write the next DCC databyte. Only when a full frame is received, is
- * the buffer head pointer updated to push the frame out to the listener.
- * The length of the packet is recorded before the data bytes.
  */
 ISR(TIMER0_COMP_vect) {
   static uint8_t hi_count; // Number of 1-bits in "pulses"
   static uint8_t pulses; // Shiftregister with latest unfiltered pinstates
   static uint8_t pulse_duration; // Duration of current filtered signal
-  static uint8_t byte_store; // Counting bits in preamble and storing databyte during reception
-  static uint8_t write_pos; // Location in buf to write databyte
-  static uint8_t state; // Current reception state
-  #define IN_FIRST_HALF (1 << 0) // First half of a DCC bit expected
-  #define DCC_VALUE (1 << 1) // Value of the first half bit
-  #define PREAMBLE (1 << 2) // Preamble bits expected
-  #define LEAD0 (1 << 3) // Leading 0 expected (follows preamble)
-  #define IN_BYTE (1 << 4) // Reading a byte
-  #define TRAILER (1 << 5) // Trailer bit expected (follows a byte)
+  uint8_t one;
+
+#ifdef MEASURE_JITTER
+  // Timer0 runs at the CPU clock in CTC mode, so TCNT0 holds the number of
+  // clockticks since the compare match.
+  jitter_record (TCNT0, TIFR & _BV(OCF0));
+#endif
 
   // Shift in current puls
   if (DCC_INPUT_PORT & _BV(DCC_INPUT_PIN)) {
@@ -182,181 +1111,26 @@ ISR(TIMER0_COMP_vect) {
   if ((pulses & (1<<6) && !(pulses & 1) && --hi_count == 2) // high-to-low transition
       || (!(pulses & (1<<6)) && (pulses & 1) && ++hi_count == 3)) { // low-to-high transition
 
-    if (pulse_duration < PULSE_DISCRIMINATOR - 1) { 
-      // Duration < 80.30 uS, half of a 1-bit
-      // Note: pulse_duration didn't increase this particular interrupt, because we will erase
-      // it anyway.
-      pulse_duration = 0;
-      if (state & IN_FIRST_HALF) { 
-        // We accept this first half and wait for the second
-        state = (state & (~(IN_FIRST_HALF))) | DCC_VALUE;
-        return;
-      } else {
-        // Second half
-        if (!(state & DCC_VALUE)) {
-          // First half was 0, second 1; does not make a valid DCC bit, restart everything
-          // Take this half 1-bit as a first half
-          state = PREAMBLE | DCC_VALUE;
-          byte_store = 0;
-          return;
-        }
-      }
-    } else {
-      // Duration >= 80.30 uS, half of a 0-bit
-      
-      pulse_duration = 0;
-      if (state & IN_FIRST_HALF) { 
-        // We accept this first half and wait for the second
-        state &= ~(IN_FIRST_HALF | DCC_VALUE);
-        return;
-      } else {
-        // Second half
-        if (state & DCC_VALUE) {
-          // First half was 1, second 0; does not make a valid DCC bit
-          if (state & LEAD0) {
-            /* 
-             * This is a special case: so far, we had only 1's, but if we caught
-             * what was the second half of such a 1 as the first half accidentally,
-             * we end up here even though the waveform is acceptable. Next is the
-             * second half of the leading 0.
-             */
-            state = LEAD0;
-            return;
-          } else {
-            // Restart everything, taking this half 1-bit as a first half
-            state = PREAMBLE;
-            byte_store = 0;
-            return;
-          }
-        }
-      }
-    }
-
-    // When we got this far, we received a valid bit, whose value is in
-    // state & DCC_VALUE
-
-    if (state & PREAMBLE) {
-      // We're in the preamble
-      if (state & DCC_VALUE) {
-        // We received a 1
-        if (byte_store >= 9) {
-          // We've received 10 preamble bits
-          // Wait for a leading 0
-          state = LEAD0 | IN_FIRST_HALF;
-          return;
-        } else {
-          // More preamble
-          byte_store++; // Count 1-bits here
-          state = PREAMBLE | IN_FIRST_HALF;
-          return;
-        }
-      } else {
-        // We received a premature 0, restart everything
-        // The last received half bit was a 0, take that in account
-        state = PREAMBLE;
-        byte_store = 0;
-        return;
-      }
-    } else if (state & LEAD0) {
-      if (state & DCC_VALUE) {
-        // We received a 1, the preamble hasn't finished yet
-        state = LEAD0 | IN_FIRST_HALF;
-        return;
-      } else {
-        // We received a 0, next should be a byte
-        uint8_t temp;
-        
-        temp = dcc_buf.head;
-
-        // Initialise packet length
-        dcc_buf.buf[temp] = 0;
-        // Set write_pos to the byte following the length
-        circ_buf_incr_ptr (&temp, DCC_BUFSIZE);
-        write_pos = temp;
-        state = IN_BYTE | IN_FIRST_HALF;
-        byte_store = 1; // This bit is used to see when we received a full byte
-        return;
-      }
-    } else if (state & IN_BYTE) {
-      // We're receiving a byte
-      uint8_t temp_data, temp_pos;
-
-      if (byte_store & (1<<7)) {
-        // Last bit in the byte
-        // Shift in a bit
-        temp_data = byte_store << 1;
-        if (state & DCC_VALUE) {
-          temp_data |= 1;
-        }
-        
-        // Check whether we have space to store it in the buffer
-        temp_pos = write_pos;
-        if (write_pos == dcc_buf.tail) {
-          // Overflow! Discard this packet
-          DCC_OVERFLOW_VAR |= DCC_OVERFLOW_BIT;
-          state = PREAMBLE | IN_FIRST_HALF; // Not that IN_FIRST_HALF matters...
-          byte_store = 0;
-          return;
-        }
-
-        // Store it in the buffer
-        dcc_buf.buf[temp_pos] = temp_data;
-
-        // Increase writing position in buffer
-        circ_buf_incr_ptr (&temp_pos, DCC_BUFSIZE);
-        write_pos = temp_pos;
-        
-        // Increase packet length
-        dcc_buf.buf[dcc_buf.head]++;
-
-        // Next is the trailer bit
-        state = TRAILER | IN_FIRST_HALF;
-        return;
-
-      } else {
-        // Not the last bit
-        // Shift in a bit
-        temp_data = byte_store << 1;
-        if (state & DCC_VALUE) {
-          temp_data |= 1;
-        }
-        byte_store = temp_data;
-        state = IN_BYTE | IN_FIRST_HALF;
-        return;
-      }
-
-    } else { // if state & TRAILER (implicit, it is none of the other states)
-      // This is the trailer bit
-      if (state & DCC_VALUE) {
-        // This is the end of the DCC message
-        // During byte reception, we allowed the buffer to go completely full
-        // This is not allowed now, because that state is indiscernable from completely empty
-
-        if (write_pos == dcc_buf.tail) {
-          // Overflow!
-          DCC_OVERFLOW_VAR |= DCC_OVERFLOW_BIT;
-        } else {
-          // Accept the message in the buffer
-          dcc_buf.head = write_pos;
-        }
-
-        state = PREAMBLE | IN_FIRST_HALF;
-        byte_store = 0;
-        return;
-
-      } else {
-        // Another byte to come
-        state = IN_BYTE | IN_FIRST_HALF;
-        byte_store = 1; // This bit is used to see when we've got a full byte
-        return;
-      }
-    }
-
+    // Duration < 80.30 uS is half of a 1-bit, longer half of a 0-bit
+    // Note: pulse_duration didn't increase this particular interrupt, because we will erase
+    // it anyway.
+    one = (pulse_duration < PULSE_DISCRIMINATOR - 1);
+#ifdef DCC_STATS
+    // The pulse lasted one sample more than counted. The filter passes a
+    // rising edge after 3 samples and a falling one after 4, so a high pulse
+    // is seen one sample longer than it is, and a low pulse one shorter.
+    stats_record_half (stats_half_bucket (
+          (hi_count == 2) ? pulse_duration : pulse_duration + 2,
+          us_samples, 1));
+#endif
+    pulse_duration = 0;
+    dcc_half_bit (&channels[0], one);
   } else {
     // Nothing changes, only adjust duration.
-    // Stop counting once it qualifies as a 0-bit to prevent overflow.
-    if (pulse_duration < PULSE_DISCRIMINATOR - 1) {
+    // Stop counting to prevent overflow.
+    if (pulse_duration < PULSE_MAX) {
       pulse_duration++;
     }
   }
 }
+#endif
@@ -25,11 +25,13 @@
 #define FILE_DCC_RECEIVER_H
 
 #include <stdint.h>
+#include "dccmon.h"
 
 /**
  * Initialise DCC receiver
  *
- * Sets the I/O-pin correctly and starts the interrupt-driven sampler. 
+ * Sets the I/O-pin correctly and starts the interrupt-driven sampler. Also
+ * starts load-shedding (dcc_shed.c).
  *
  * It is assumed the uC is in it's default settings with regard to periphery.
  * The DDR register is only explicitly programmed to reduce the chance of a
@@ -37,13 +39,6 @@
  */
 extern void dcc_init();
 
-/**
- * Check if buffer has data available.
- * Returns true when there is no data available and a call to dcc_get would
- * block waiting for data. Returns false otherwise.
- */
-extern uint8_t dcc_would_block ();
-
 /**
  * Check and clear overflow indication.
  * Returns true when an overflow has occured since the last time this routine
@@ -52,12 +47,93 @@ extern uint8_t dcc_would_block ();
 extern uint8_t dcc_overflow_status ();
 
 /**
- * Get a byte of data from the buffer.
- * If needed, block waiting for new data.
- * Data returned is a byte indicating the length of the next DCC frame,
- * followed by that many bytes of DCC data. When the length is available,
- * the whole frame is available without blocking.
+ * Get the next DCC packet from the buffer, if available.
+ *
+ * The packet is copied into packet[], which should be DCC_MAX_PACKET bytes
+ * big. Returns the length of the packet, or 0 when no packet is available.
+ *
+ * With DCC_WIRE_CAPTURE, the packet is a complete Communication protocol frame
+ * in the 7-in-8 coding, ready for comm_send_wire(), and the length is that of
+ * the frame. Use dcc_first_byte() and dcc_is_idle() to look at it.
+ */
+extern uint8_t dcc_get_packet (uint8_t packet[]);
+
+#ifdef DCC_PACKET_TIME
+/**
+ * RTC time of the end bit of the packet last returned by dcc_get_packet()
+ *
+ * Only present with DCC_TIMESTAMP or DCC_IDLE_ELISION. The receiver stores the
+ * lower 16 bits, which are extended with the current time; this is only right
+ * when the packet is less than a wrap of Timer1 old, about 6 seconds. The time
+ * slots keep it well below that, see MAX_BOARDS in slots.c.
+ */
+extern uint32_t dcc_packet_time ();
+#endif
+
+#ifdef DCC_DUAL_CHANNEL
+/**
+ * DCC input of the packet last returned by dcc_get_packet(): 0 for
+ * DCC_INPUT_PIN, 1 for DCC_INPUT_PIN2
+ */
+extern uint8_t dcc_packet_channel ();
+#endif
+
+#if DCC_VALIDATE == 1
+/**
+ * Error class of the packet last returned by dcc_get_packet(), see
+ * dcc_validate.h, or 0 when it passed validation.
+ */
+extern uint8_t dcc_packet_error ();
+#endif
+
+#ifdef DCC_WIRE_CAPTURE
+/**
+ * First DCC byte of packet p of len bytes from dcc_get_packet()
+ *
+ * It's MSB is bit 0 of the first hi-bits byte, which follows the first 7
+ * databytes, or all of them in a shorter frame.
+ */
+#define dcc_first_byte(p, len) \
+  ((uint8_t) ((p)[1] | ((p)[((len) >= 10) ? 8 : (len) - 2] << 7)))
+
+/**
+ * Second DCC byte of packet p of len bytes from dcc_get_packet(); it's MSB is
+ * bit 1 of the first hi-bits byte. Check dcc_too_short() first.
+ */
+#define dcc_second_byte(p, len) \
+  ((uint8_t) ((p)[2] | (((p)[((len) >= 10) ? 8 : (len) - 2] >> 1) << 7)))
+
+/**
+ * Check whether a packet of len bytes from dcc_get_packet() has less than two
+ * DCC bytes: the frame start, hi-bits and parity byte take 3 positions
+ */
+#define dcc_too_short(len) ((len) < 5)
+
+/**
+ * Check whether packet p of len bytes from dcc_get_packet() is an idle
+ * packet: FF 00 FF, in wire form 81h 7Fh 00h 7Fh 05h 04h
+ */
+#define dcc_is_idle(p, len) ((len) == 6 && (p)[1] == 0x7F && (p)[2] == 0x00 \
+    && (p)[3] == 0x7F && (p)[4] == 0x05)
+
+/**
+ * Check whether packet p of len bytes from dcc_get_packet() is a reset
+ * packet: 00 00 00, in wire form 81h 00h 00h 00h 00h 01h
+ */
+#define dcc_is_reset(p, len) ((len) == 6 && (p)[1] == 0x00 && (p)[2] == 0x00 \
+    && (p)[3] == 0x00 && (p)[4] == 0x00)
+#else
+#define dcc_first_byte(p, len) ((p)[0])
+#define dcc_second_byte(p, len) ((p)[1])
+#define dcc_too_short(len) ((len) < 2)
+#define dcc_is_idle(p, len) ((len) == 3 && (p)[0] == 0xFF && (p)[1] == 0x00)
+#define dcc_is_reset(p, len) ((len) == 3 && (p)[0] == 0x00 && (p)[1] == 0x00)
+#endif
+
+/**
+ * Number of bytes in the DCC buffer, to gauge the pressure on it. With
+ * DCC_DUAL_CHANNEL, that of the fullest buffer.
  */
-extern unsigned char dcc_get ();
+extern uint8_t dcc_buffer_used ();
 
 #endif // ndef FILE_DCC_RECEIVER_H
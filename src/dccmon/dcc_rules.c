@@ -0,0 +1,189 @@
+/**
+ * DCC filter rules
+ *
+ * The filter classifies every DCC packet by it's first two bytes (see
+ * dcc_class.c), and looks up what to do with it in a small table of rules,
+ * each matching a set of packet classes and a range of addresses. The first
+ * matching rule decides.
+ *
+ * Whenever a rule changes, the table is compiled per class: rules that match
+ * every packet of the class end the search, rules that can never match it are
+ * left out. Deciding on a packet then takes at most one range comparison per
+ * rule with a limited address range, and none at all for the usual tables
+ * that only select classes.
+ *
+ * The default table only sends Accessory Decoder packets, like the filter did
+ * before it had rules.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <avr/io.h>
+#include "../common/global.h"
+#include "../common/comm_proto.h"
+#include "dcc_receiver.h"
+#include "dccmon.h"
+#include "dcc_rules.h"
+
+/**
+ * Classes with an address
+ */
+#define ADDRESSED_CLASSES (_BV(DCC_CLASS_MF7) | _BV(DCC_CLASS_MF14) \
+    | _BV(DCC_CLASS_BASIC_ACC) | _BV(DCC_CLASS_EXT_ACC))
+
+/**
+ * The rule table
+ */
+static uint16_t rule_classes[RULES_MAX] = {
+  _BV(DCC_CLASS_BASIC_ACC) | _BV(DCC_CLASS_EXT_ACC)
+};
+static uint16_t rule_low[RULES_MAX];
+static uint16_t rule_high[RULES_MAX] = { RULE_ADDR_MAX };
+static uint8_t rule_send = _BV(0); // Bit r set: rule r sends; bit RULES_MAX: the default action
+
+/**
+ * The compiled table, per class: the rules to compare the address with, as a
+ * bit mask, and the rule deciding when none of them matches.
+ */
+static uint8_t class_ranges[DCC_CLASSES];
+static uint8_t class_final[DCC_CLASSES] = {
+  [0 ... DCC_CLASSES - 1] = RULES_MAX,
+  [DCC_CLASS_BASIC_ACC] = 0,
+  [DCC_CLASS_EXT_ACC] = 0
+};
+
+/**
+ * Number of packets decided by every rule, and by the default action
+ */
+static uint16_t rule_hits[RULES_MAX + 1];
+
+/**
+ * Compile the rule table into class_ranges[] and class_final[]
+ */
+static void rules_compile () {
+  uint8_t class, rule, ranges;
+
+  for (class = 0; class < DCC_CLASSES; class++) {
+    ranges = 0;
+    for (rule = 0; rule < RULES_MAX; rule++) {
+      if (!(rule_classes[rule] & _BV(class))) {
+        continue;
+      }
+      if (!(ADDRESSED_CLASSES & _BV(class))) {
+        // Address 0
+        if (rule_low[rule] == 0) {
+          break;
+        }
+        continue; // Never matches
+      }
+      if (rule_low[rule] == 0 && rule_high[rule] == RULE_ADDR_MAX) {
+        // Matches every packet of the class
+        break;
+      }
+      ranges |= _BV(rule);
+    }
+    class_ranges[class] = ranges;
+    class_final[class] = rule; // RULES_MAX when no rule matched all
+  }
+}
+
+/**
+ * Clear all rules
+ */
+void dcc_rules_clear (const uint8_t send) {
+  uint8_t rule;
+
+  for (rule = 0; rule < RULES_MAX; rule++) {
+    rule_classes[rule] = 0;
+    rule_hits[rule] = 0;
+  }
+  rule_hits[RULES_MAX] = 0;
+  rule_send = send ? _BV(RULES_MAX) : 0;
+  rules_compile ();
+}
+
+/**
+ * Set rule 'rule'
+ */
+uint8_t dcc_rules_set (const uint8_t rule, const uint16_t classes,
+    const uint8_t send, const uint16_t low, const uint16_t high) {
+  if (rule >= RULES_MAX || classes >= _BV(DCC_CLASSES)
+      || high > RULE_ADDR_MAX) {
+    return 0;
+  }
+
+  rule_classes[rule] = classes;
+  rule_low[rule] = low;
+  rule_high[rule] = high;
+  if (send) {
+    rule_send |= _BV(rule);
+  } else {
+    rule_send &= ~_BV(rule);
+  }
+  rules_compile ();
+  return 1;
+}
+
+/**
+ * Decide whether to send a DCC packet, and count the hit of the deciding rule.
+ */
+uint8_t dcc_rules_send (const uint8_t packet[], const uint8_t len) {
+  uint8_t class, rule, ranges;
+  uint16_t address;
+
+  class = dcc_classify (packet, len, &address);
+
+  // Compare the address with the rules that have a range, in order
+  ranges = class_ranges[class];
+  for (rule = 0; ranges; rule++, ranges >>= 1) {
+    if ((ranges & 1) && address >= rule_low[rule]
+        && address <= rule_high[rule]) {
+      break;
+    }
+  }
+  if (!ranges) {
+    rule = class_final[class];
+  }
+
+  if (rule_hits[rule] != UINT16_MAX) {
+    rule_hits[rule]++;
+  }
+  return rule_send & _BV(rule);
+}
+
+/**
+ * Send the "Filter rule hits" management frames and reset the counters.
+ */
+int8_t dcc_rules_report () {
+  uint8_t part, i;
+
+  for (part = 0; part < 2; part++) {
+    comm_start_frame (MANAG_PROTO);
+    comm_send_byte (MANAG_DCC_OOB);
+    comm_send_byte (MANAG_DCC_RULE_HITS);
+    comm_send_byte (part);
+    for (i = part * 4; i < part * 4 + 4; i++) {
+      comm_send_byte (rule_hits[i] >> 8);
+      comm_send_byte (rule_hits[i] & 0xff);
+      rule_hits[i] = 0;
+    }
+    comm_end_frame ();
+  }
+  return 1;
+}
@@ -0,0 +1,77 @@
+/**
+ * DCC filter rules header file
+ *
+ * Defines the rule table deciding which DCC packets the filter sends to the
+ * PC.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_DCC_RULES_H
+#define FILE_DCC_RULES_H
+
+#include <stdint.h>
+#include "dcc_class.h"
+
+/**
+ * Number of rules; rule number RULES_MAX stands for the default action
+ */
+#define RULES_MAX 7
+
+/**
+ * Highest address a rule can give: 14 bits
+ */
+#define RULE_ADDR_MAX 0x3FFF
+
+/**
+ * Clear all rules
+ *
+ * send: non-zero to send packets that match no rule, zero to drop them
+ *
+ * Also resets the hit counters.
+ */
+extern void dcc_rules_clear (const uint8_t send);
+
+/**
+ * Set rule 'rule'
+ *
+ * The rule matches packets of the classes with their bit set in 'classes' and
+ * an address from 'low' up to and including 'high'. The first matching rule
+ * decides; it sends the packet when 'send' is non-zero, and drops it
+ * otherwise. A rule without classes matches nothing.
+ *
+ * Returns zero when an argument is out of range.
+ */
+extern uint8_t dcc_rules_set (const uint8_t rule, const uint16_t classes,
+    const uint8_t send, const uint16_t low, const uint16_t high);
+
+/**
+ * Decide whether to send DCC packet 'packet' of 'len' bytes, as returned by
+ * dcc_get_packet(), and count the hit of the deciding rule.
+ *
+ * Returns non-zero when the packet should be sent.
+ */
+extern uint8_t dcc_rules_send (const uint8_t packet[], const uint8_t len);
+
+/**
+ * Send the "Filter rule hits" management frames and reset the counters.
+ *
+ * Returns non-zero when a frame was sent.
+ */
+extern int8_t dcc_rules_report ();
+
+#endif // ndef FILE_DCC_RULES_H
@@ -1,10 +1,11 @@
 /**
- * Variant on dcc_proto.c that implements filtering out Accessory Decoder
- * packets.
+ * Variant on dcc_proto.c that implements filtering of DCC packets.
  *
  * This file overrides the default handle_keys() so key 2 toggles the filter.
- * When on, the filter only sends DCC packets addressed to an Accessory Decoder
- * to the PC, and discards the other packets received from the DCC bus.
+ * When on, the filter only sends the DCC packets selected by the filter rules
+ * (dcc_rules.c) to the PC, and discards the other packets received from the
+ * DCC bus. The default rules select the packets addressed to an Accessory
+ * Decoder. The PC can change the rules with commands.
  * 
  * For integration with automated tests, the monitor_init() alias in
  * dcc_receiver.c is only aliased weakly to dcc_init(). If automated tests are
@@ -37,6 +38,17 @@
 #include "../common/keys.h"
 #include "dcc_receiver.h"
 #include "dccmon.h"
+#include "dcc_shed.h"
+#include "dcc_rules.h"
+#ifdef DCC_VALIDATE
+#include "dcc_validate.h"
+#endif
+#ifdef DCC_TIMESTAMP
+#include "dcc_timestamp.h"
+#endif
+#ifdef DCC_SUMMARY
+#include "dcc_summary.h"
+#endif
 #include "dcc_send_filter.h"
 
 // This bit in this variable is 1 when we filter on Accessory Decoder packets
@@ -55,6 +67,44 @@ void monitor_init () {
 }
 #endif
 
+/**
+ * Switch filtering on Accessory Decoder packets on or off
+ *
+ * Gives visual confirmation on LED 2 and sends a management message to indicate
+ * the new state to the user. The message is sent even if the state did not
+ * change.
+ */
+static void filter_set (const uint8_t on) {
+  if (on) {
+    // Start filtering
+    
+    FILTER_STATE_VAR |= FILTER_STATE_BIT;
+    
+    // Visual confirmation
+    led_on (2);
+
+    // Send management message for indication to user
+    comm_start_frame (MANAG_PROTO);
+    comm_send_byte (MANAG_DCC_OOB); // DCC out-of-band data
+    comm_send_byte (MANAG_DCC_ACC_FILTER); // Accessory Decoder filter on
+    comm_end_frame();
+
+  } else {
+    // Stop filtering
+    
+    FILTER_STATE_VAR &= ~FILTER_STATE_BIT;
+
+    // Visual confirmation
+    led_off (2);
+    
+    // Send management message for indication to user
+    comm_start_frame (MANAG_PROTO);
+    comm_send_byte (MANAG_DCC_OOB); // DCC out-of-band data
+    comm_send_byte (MANAG_DCC_NO_ACC_FILTER); // Accessory Decoder filter off
+    comm_end_frame();
+  }
+}
+
 /**
  * Handle keypresses
  *
@@ -82,39 +132,8 @@ int8_t handle_keys () {
 
     if (keys_pressed & (1 << 2)) {
       // Toggle filtering state
-      
-      if (!(FILTER_STATE_VAR & FILTER_STATE_BIT)) {
-        // Start filtering
-        
-        FILTER_STATE_VAR |= FILTER_STATE_BIT;
-        
-        // Visual confirmation
-        led_on (2);
-
-        // Send management message for indication to user
-        comm_start_frame (MANAG_PROTO);
-        comm_send_byte (MANAG_DCC_OOB); // DCC out-of-band data
-        comm_send_byte (MANAG_DCC_ACC_FILTER); // Accessory Decoder filter on
-        comm_end_frame();
-        
-        retval = 1;
-
-      } else {
-        // Stop filtering
-        
-        FILTER_STATE_VAR &= ~FILTER_STATE_BIT;
-
-        // Visual confirmation
-        led_off (2);
-        
-        // Send management message for indication to user
-        comm_start_frame (MANAG_PROTO);
-        comm_send_byte (MANAG_DCC_OOB); // DCC out-of-band data
-        comm_send_byte (MANAG_DCC_NO_ACC_FILTER); // Accessory Decoder filter on
-        comm_end_frame();
-
-        retval = 1;
-      }
+      filter_set (!(FILTER_STATE_VAR & FILTER_STATE_BIT));
+      retval = 1;
     }
 
     // When INCLUDE_TESTS is defined, keys start and stop tests.
@@ -134,6 +153,60 @@ int8_t handle_keys () {
   return retval;
 }
 
+/**
+ * Handle commands from the PC
+ *
+ * CMD_DCC_FILTER switches filtering on or off, just like key 2 does. The
+ * other commands change the filter rules, or report how often they were hit.
+ * CMD_DCC_SUMMARY switches summary mode on or off.
+ * Numbers of more than 7 bits are sent as two bytes of 7 bits, high byte
+ * first.
+ */
+uint8_t monitor_command (const uint8_t cmd[], const uint8_t len) {
+  switch (cmd[0]) {
+  case CMD_DCC_FILTER:
+    if (len != 2 || cmd[1] > 1) {
+      return CMD_BAD_ARGS;
+    }
+    filter_set (cmd[1]);
+    return CMD_OK;
+
+  case CMD_DCC_RULES_CLEAR:
+    if (len != 2 || cmd[1] > 1) {
+      return CMD_BAD_ARGS;
+    }
+    dcc_rules_clear (cmd[1]);
+    return CMD_OK;
+
+  case CMD_DCC_RULE:
+    // Rule, classes (2), action, low address (2), high address (2)
+    if (len != 9 || cmd[4] > 1
+        || !dcc_rules_set (cmd[1], (cmd[2] << 7) | cmd[3], cmd[4],
+          (cmd[5] << 7) | cmd[6], (cmd[7] << 7) | cmd[8])) {
+      return CMD_BAD_ARGS;
+    }
+    return CMD_OK;
+
+  case CMD_DCC_RULE_HITS:
+    if (len != 1) {
+      return CMD_BAD_ARGS;
+    }
+    dcc_rules_report ();
+    return CMD_OK;
+
+#ifdef DCC_SUMMARY
+  case CMD_DCC_SUMMARY:
+    if (len != 2 || cmd[1] > 1) {
+      return CMD_BAD_ARGS;
+    }
+    dcc_summary_set (cmd[1]);
+    return CMD_OK;
+#endif
+
+  default:
+    return CMD_UNKNOWN;
+  }
+}
 
 /**
  * Get received DCC data from the buffer if available, and send it to the PC
@@ -141,7 +214,11 @@ int8_t handle_keys () {
  *
  * Only one frame is sent to the PC, even if more are available.
  *
- * If filtering is enabled, send only Accessory Decoder packets.
+ * If filtering is enabled, send only the packets selected by the filter
+ * rules. Under pressure, packets of little value are dropped by dcc_shed().
+ * With DCC_IDLE_ELISION, idle packets are dropped and counted by dcc_elide()
+ * first, so the rules never see them. In summary mode (DCC_SUMMARY), nothing is
+ * sent; dcc_summary_take() counts the packets instead.
  *
  * Also checks for and reports overflows. If an overflow report is sent to the
  * PC, a data frame is sent as well to relieve pressure on the buffer.
@@ -150,78 +227,65 @@ int8_t handle_keys () {
  */
 int8_t dcc_send_filter () {
   int8_t retval;
+  uint8_t packet[DCC_MAX_PACKET];
   uint8_t dcc_length;
-  // Address partition of packet; this is the first byte in the packet
-  uint8_t dcc_addr_part; 
 
   retval = 0;
 
+#ifdef DCC_SUMMARY
+  if (dcc_summary_take (packet)) {
+    // Summary mode: packets and overflows are only counted
+    return 0;
+  }
+#endif
+
   // Check for overflow on DCC bus
   if (dcc_overflow_status()) {
     // Overflow
-    comm_start_frame (MANAG_PROTO); // Management protocol
-    comm_send_byte (MANAG_BUS_OVF); // Overflow of monitored bus
-    comm_end_frame ();
+    comm_send_manag_code (MANAG_BUS_OVF); // Overflow of monitored bus
     retval = 1;
   }
     
-  if (!dcc_would_block()) {
+  dcc_length = dcc_get_packet (packet);
+#ifdef DCC_IDLE_ELISION
+  if (dcc_length && dcc_elide (packet, dcc_length)) {
+    // Only counted
+    dcc_length = 0;
+  }
+#endif
+  if (dcc_length) {
     // We have a DCC packet to send
-    
-    dcc_length = dcc_get();
 
-    if (!(FILTER_STATE_VAR & FILTER_STATE_BIT)) {
-      // Unfiltered output
+    /* When filtering, the rules decide.
+     * Note that dcc_length is necessarily always minimally 1. There is no
+     * waveform thinkable that would not clock in a single databyte.
+     */
+    if ((!(FILTER_STATE_VAR & FILTER_STATE_BIT)
+          || dcc_rules_send (packet, dcc_length))
+        && !dcc_shed (packet, dcc_length)) {
       // Send the frame
 
-      comm_start_frame (DCC_PROTO);
-      for (; dcc_length > 0; dcc_length--) {
-        comm_send_byte (dcc_get());
-      }
-      comm_end_frame ();
+#ifdef DCC_WIRE_CAPTURE
+      comm_send_wire (packet, dcc_length);
+#elif defined(DCC_TIMESTAMP)
+      dcc_send_stamped (packet, dcc_length);
+#elif defined(DCC_DUAL_CHANNEL)
+      comm_send_frame_dict (dcc_packet_channel () ? DCC_CH1_PROTO : DCC_PROTO,
+          packet, dcc_length);
+#else
+      comm_send_frame_dict (DCC_PROTO, packet, dcc_length);
+#endif
+#if DCC_VALIDATE == 1
+      // Tell the PC when it failed validation
+      dcc_validate_flag ();
+#endif
       
       // We sent a frame
       return 1;
     }
 
-    // Filter on accessory decoder packets
-    
-
-    // Note that dcc_length is necessarily always minimally 1. There is no
-    // waveform thinkable that would not clock in a single databyte. So
-    // checking the length is redundant for that one byte.
-
-    dcc_addr_part = dcc_get();
-
-    if ((dcc_addr_part & 0xC0) == 0x80) {
-      /* The first address byte has the form:
-       * 10XXXXXX
-       * That's the accessory decoder space
-       * Send packet
-       */
-
-      comm_start_frame (DCC_PROTO);
-      
-      comm_send_byte (dcc_addr_part); // Already read that
-      dcc_length--;
-
-      // Send the rest of the packet
-      for (; dcc_length > 0; dcc_length--) {
-        comm_send_byte (dcc_get());
-      }
-      comm_end_frame();
-
-      // We sent a frame
-      return 1;
-    
-    } else {
-      // Not an accessory decoder packet, read rest of packet and discard
-
-      dcc_length--; // Already read one byte
-      for (; dcc_length > 0; dcc_length--) {
-        dcc_get();
-      }
-    }
+    // Dropped by the rules, or shed; it has been taken from the
+    // buffer already, so it is discarded
   }
 
   return retval;
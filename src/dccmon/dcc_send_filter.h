@@ -41,7 +41,8 @@
  *
  * Only one frame is sent to the PC, even if more are available.
  *
- * If filtering is enabled, send only Accessory Decoder packets.
+ * If filtering is enabled, send only the packets selected by the filter
+ * rules (dcc_rules.h).
  *
  * Also checks for and reports overflows. If an overflow report is sent to the
  * PC, a data frame is sent as well to relieve pressure on the buffer.
@@ -0,0 +1,273 @@
+/**
+ * DCC load-shedding
+ *
+ * When the link to the PC can't keep up, the buffers fill up and eventually
+ * overflow, dropping whatever packet or frame is being received at that time.
+ * To prevent that, packets of little value for debugging are dropped first, in
+ * steps, as the pressure rises.
+ *
+ * The pressure is the fill level of the fullest of three buffers: the DCC
+ * buffer, the buffer holding frames from the daisy-chain and the UART 0
+ * transmit buffer. When the daisy-chain buffer fills, link time spent on our
+ * own packets is better spent on forwarding; when the transmit buffer fills,
+ * the link is not keeping up with what was already sent to it. Per quarter of
+ * the buffer that is in use, a level is added:
+ * - level 1: DCC idle packets are dropped
+ * - level 2: packets that are exact repeats of the last sent packet are dropped
+ * - level 3: only Accessory Decoder packets are still sent
+ *
+ * Every second in which packets were dropped, a summary is sent to the PC in a
+ * "Load-shedding summary" management frame.
+ *
+ * With DCC_IDLE_ELISION, idle packets (and with DCC_IDLE_ELISION=2 also reset
+ * packets) are never sent, whatever the pressure. They are only counted, and
+ * sent every second in an "Elided packets" management frame, together with the
+ * longest time between two idle packets. The time is that of their end bits,
+ * as stored by the receiver, so it does not depend on when the main loop gets
+ * to them. With DCC_DUAL_CHANNEL, the time between idle packets is taken per
+ * input, and the longest of both is reported.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include "../common/global.h"
+#include "../common/comm_proto.h"
+#include "../common/timer.h"
+#include "../common/rtc.h"
+#include "../common/uart.h"
+#include "dcc_receiver.h"
+#include "dccmon.h"
+#include "dcc_shed.h"
+
+// Load-shedding levels
+#define SHED_IDLE 1 // Drop idle packets
+#define SHED_REPEAT 2 // Also drop exact repeats
+#define SHED_NON_ACC 3 // Also drop everything but Accessory Decoder packets
+
+/**
+ * The last packet sent to the PC, to recognise exact repeats
+ */
+static uint8_t last_packet[DCC_MAX_PACKET];
+static uint8_t last_len;
+
+// Statistics for the summary, saturating at 255
+static uint8_t shed_max_level; // Highest level reached
+static uint8_t shed_idle; // Dropped idle packets
+static uint8_t shed_repeat; // Dropped repeats
+static uint8_t shed_non_acc; // Dropped other packets
+
+/**
+ * Increase a counter, saturating at 255
+ */
+#define shed_count(x) do { \
+  if ((x) != UINT8_MAX) { \
+    (x)++; \
+  } \
+} while (0)
+
+#ifdef DCC_IDLE_ELISION
+// Elided packets since the last report, saturating at 65535
+static uint16_t elide_idle;
+static uint16_t elide_reset;
+
+// Per DCC input: RTC time of the end bit of the last idle packet, and non-zero
+// once an idle packet has been seen
+static uint32_t elide_last_idle[DCC_CHANNELS];
+static uint8_t elide_started[DCC_CHANNELS];
+static uint32_t elide_longest; // Longest time between two idle packets, in RTC ticks
+
+/**
+ * Decide whether to elide a DCC packet: idle packets and, with
+ * DCC_IDLE_ELISION=2, reset packets.
+ */
+uint8_t dcc_elide (const uint8_t packet[], const uint8_t len) {
+  uint32_t time;
+  uint8_t ch;
+
+  if (dcc_is_idle (packet, len)) {
+    if (elide_idle != UINT16_MAX) {
+      elide_idle++;
+    }
+
+#ifdef DCC_DUAL_CHANNEL
+    ch = dcc_packet_channel ();
+#else
+    ch = 0;
+#endif
+    time = dcc_packet_time ();
+    if (elide_started[ch] && time - elide_last_idle[ch] > elide_longest) {
+      elide_longest = time - elide_last_idle[ch];
+    }
+    elide_last_idle[ch] = time;
+    elide_started[ch] = 1;
+    return 1;
+  }
+
+#if DCC_IDLE_ELISION == 2
+  if (dcc_is_reset (packet, len)) {
+    if (elide_reset != UINT16_MAX) {
+      elide_reset++;
+    }
+    return 1;
+  }
+#endif
+  return 0;
+}
+
+/**
+ * Send the "Elided packets" management frame, if packets were elided, and
+ * reset the counts.
+ */
+static int8_t elide_report () {
+  uint16_t longest;
+
+  if (!(elide_idle | elide_reset)) {
+    return 0;
+  }
+
+  // Longest gap in milliseconds, saturating
+  if (elide_longest >= (uint32_t) UINT16_MAX * rtc_period (1 seconds) / 1000) {
+    longest = UINT16_MAX;
+  } else {
+    longest = elide_longest * 1000 / rtc_period (1 seconds);
+  }
+
+  comm_start_frame (MANAG_PROTO);
+  comm_send_byte (MANAG_DCC_OOB);
+  comm_send_byte (MANAG_DCC_ELIDED);
+  comm_send_byte (elide_idle >> 8);
+  comm_send_byte (elide_idle & 0xff);
+  comm_send_byte (elide_reset >> 8);
+  comm_send_byte (elide_reset & 0xff);
+  comm_send_byte (longest >> 8);
+  comm_send_byte (longest & 0xff);
+  comm_end_frame ();
+
+  elide_idle = 0;
+  elide_reset = 0;
+  elide_longest = 0;
+  return 1;
+}
+#endif
+
+/**
+ * Compute the current load-shedding level: the number of quarters of the
+ * fullest buffer that are in use.
+ */
+static uint8_t shed_level () {
+  uint8_t level, other;
+
+  level = (uint16_t) dcc_buffer_used () * 4 / DCC_BUFSIZE;
+  other = (uint16_t) comm_rx_used () * 4 / UART1_RX_BUFSIZE;
+  if (other > level) {
+    level = other;
+  }
+  other = (uint16_t) uart0_tx_used () * 4 / UART0_TX_BUFSIZE;
+  if (other > level) {
+    level = other;
+  }
+  return level;
+}
+
+/**
+ * Decide whether to drop a DCC packet because of pressure on the buffers.
+ */
+uint8_t dcc_shed (const uint8_t packet[], const uint8_t len) {
+  uint8_t level, i, repeat;
+
+  level = shed_level ();
+  if (level > shed_max_level) {
+    shed_max_level = level;
+  }
+
+  if (level >= SHED_IDLE && dcc_is_idle (packet, len)) {
+    // Idle packet: FF 00 FF
+    shed_count (shed_idle);
+    return 1;
+  }
+
+  repeat = (len == last_len);
+  for (i = 0; repeat && i < len; i++) {
+    repeat = (packet[i] == last_packet[i]);
+  }
+
+  if (level >= SHED_REPEAT && repeat) {
+    shed_count (shed_repeat);
+    return 1;
+  }
+
+  // The first address byte of an Accessory Decoder packet is 10XXXXXX
+  if (level >= SHED_NON_ACC && (dcc_first_byte (packet, len) & 0xC0) != 0x80) {
+    shed_count (shed_non_acc);
+    return 1;
+  }
+
+  // The packet is sent; remember it
+  if (!repeat) {
+    for (i = 0; i < len; i++) {
+      last_packet[i] = packet[i];
+    }
+    last_len = len;
+  }
+  return 0;
+}
+
+/**
+ * Send the "Load-shedding summary" management frame, if packets were dropped,
+ * and reset the statistics. With DCC_IDLE_ELISION, the "Elided packets" frame
+ * is sent from here as well.
+ *
+ * Run every second by a software timer.
+ */
+static int8_t dcc_shed_report () {
+  int8_t retval;
+
+  retval = 0;
+#ifdef DCC_IDLE_ELISION
+  retval = elide_report ();
+#endif
+
+  if (!(shed_idle | shed_repeat | shed_non_acc)) {
+    // Nothing dropped
+    shed_max_level = 0;
+    return retval;
+  }
+
+  comm_start_frame (MANAG_PROTO);
+  comm_send_byte (MANAG_DCC_OOB);
+  comm_send_byte (MANAG_DCC_SHED);
+  comm_send_byte (shed_max_level);
+  comm_send_byte (shed_idle);
+  comm_send_byte (shed_repeat);
+  comm_send_byte (shed_non_acc);
+  comm_end_frame ();
+
+  shed_max_level = 0;
+  shed_idle = 0;
+  shed_repeat = 0;
+  shed_non_acc = 0;
+  return 1;
+}
+
+/**
+ * Initialise load-shedding
+ */
+void dcc_shed_init () {
+  timer_add (dcc_shed_report, rtc_period (1 seconds), rtc_period (1 seconds));
+}
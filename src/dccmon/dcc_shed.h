@@ -0,0 +1,61 @@
+/**
+ * DCC load-shedding header file
+ *
+ * Defines the routines deciding which DCC packets are dropped when the link to
+ * the PC can't keep up.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_DCC_SHED_H
+#define FILE_DCC_SHED_H
+
+#include <stdint.h>
+
+/**
+ * Initialise load-shedding
+ *
+ * Registers the software timer sending the summary of dropped packets.
+ *
+ * Precondition: rtc_init() has been called.
+ */
+extern void dcc_shed_init ();
+
+/**
+ * Decide whether to drop a DCC packet because of pressure on the buffers.
+ *
+ * Should be called for every packet that would otherwise be sent to the PC,
+ * as returned by dcc_get_packet().
+ * Returns non-zero when the packet should be dropped; it is then counted for
+ * the summary.
+ */
+extern uint8_t dcc_shed (const uint8_t packet[], const uint8_t len);
+
+#ifdef DCC_IDLE_ELISION
+/**
+ * Decide whether to elide a DCC packet: idle packets and, with
+ * DCC_IDLE_ELISION=2, reset packets.
+ *
+ * Should be called for every packet returned by dcc_get_packet(), before any
+ * other decision on it. Returns non-zero when the packet should be dropped;
+ * it is then counted for the "Elided packets" report, which is sent by the
+ * load-shedding summary job.
+ */
+extern uint8_t dcc_elide (const uint8_t packet[], const uint8_t len);
+#endif
+
+#endif // ndef FILE_DCC_SHED_H
@@ -0,0 +1,138 @@
+/**
+ * DCC signal statistics
+ *
+ * The DCC receiver sees the duration of every half-bit, the length of every
+ * preamble and the time between packets. Instead of throwing them away, it
+ * counts them in histograms, together with the half-bits and preambles that
+ * are outside the NMRA limits. Every second, the histograms are sent to the
+ * PC in "Signal statistics" management frames and reset. A command station
+ * drifting out of spec then shows up without a scope on the bus.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include "../common/global.h"
+#include "../common/comm_proto.h"
+#include "../common/timer.h"
+#include "../common/rtc.h"
+#include "dcc_stats.h"
+
+uint16_t stats_half[STATS_HALF_BUCKETS];
+uint8_t stats_preamble[STATS_PREAMBLE_BUCKETS];
+uint8_t stats_gap[STATS_GAP_BUCKETS];
+uint16_t stats_out_of_spec;
+uint16_t stats_packet_end;
+uint8_t stats_end_age = STATS_AGE_NONE;
+
+/**
+ * Send the half-bit durations of buckets first up to first + 3, and reset them
+ */
+static void report_half (const uint8_t first) {
+  uint16_t counts[4];
+  uint8_t i;
+
+  cli(); // Start of critical section
+  for (i = 0; i < 4; i++) {
+    counts[i] = stats_half[first + i];
+    stats_half[first + i] = 0;
+  }
+  sei(); // End of critical section
+
+  comm_start_frame (MANAG_PROTO);
+  comm_send_byte (MANAG_DCC_OOB);
+  comm_send_byte (MANAG_DCC_STATS);
+  comm_send_byte (first / 4); // Part 0 or 1
+  for (i = 0; i < 4; i++) {
+    comm_send_byte (counts[i] >> 8);
+    comm_send_byte (counts[i] & 0xff);
+  }
+  comm_end_frame ();
+}
+
+/**
+ * Send the "Signal statistics" management frames and reset the statistics,
+ * when a packet was received since the last report.
+ *
+ * Run every second by a software timer.
+ */
+static int8_t dcc_stats_report () {
+  uint8_t preamble[STATS_PREAMBLE_BUCKETS], gap[STATS_GAP_BUCKETS];
+  uint8_t i, packets;
+  uint16_t out_of_spec;
+
+  cli(); // Start of critical section
+  packets = 0;
+  for (i = 0; i < STATS_PREAMBLE_BUCKETS; i++) {
+    preamble[i] = stats_preamble[i];
+    packets |= preamble[i];
+    stats_preamble[i] = 0;
+  }
+  for (i = 0; i < STATS_GAP_BUCKETS; i++) {
+    gap[i] = stats_gap[i];
+    stats_gap[i] = 0;
+  }
+  out_of_spec = stats_out_of_spec;
+  stats_out_of_spec = 0;
+  if (stats_end_age < STATS_AGE_OLD) {
+    stats_end_age++;
+  }
+  sei(); // End of critical section
+
+  if (!packets) {
+    // No DCC signal, or nothing but noise
+    cli(); // Start of critical section
+    for (i = 0; i < STATS_HALF_BUCKETS; i++) {
+      stats_half[i] = 0;
+    }
+    sei(); // End of critical section
+    return 0;
+  }
+
+  report_half (0);
+  report_half (4);
+
+  comm_start_frame (MANAG_PROTO);
+  comm_send_byte (MANAG_DCC_OOB);
+  comm_send_byte (MANAG_DCC_STATS);
+  comm_send_byte (2); // Part 2: preambles and out-of-spec count
+  for (i = 0; i < STATS_PREAMBLE_BUCKETS; i++) {
+    comm_send_byte (preamble[i]);
+  }
+  comm_send_byte (out_of_spec >> 8);
+  comm_send_byte (out_of_spec & 0xff);
+  comm_end_frame ();
+
+  comm_start_frame (MANAG_PROTO);
+  comm_send_byte (MANAG_DCC_OOB);
+  comm_send_byte (MANAG_DCC_STATS);
+  comm_send_byte (3); // Part 3: gaps between packets
+  for (i = 0; i < STATS_GAP_BUCKETS; i++) {
+    comm_send_byte (gap[i]);
+  }
+  comm_end_frame ();
+  return 1;
+}
+
+/**
+ * Start reporting the statistics
+ */
+void dcc_stats_init () {
+  timer_add (dcc_stats_report, rtc_period (1 seconds), rtc_period (1 seconds));
+}
@@ -0,0 +1,160 @@
+/**
+ * DCC signal statistics header file
+ *
+ * Defines the counters the DCC receiver keeps on the timing of the signal,
+ * and the routines reporting them.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_DCC_STATS_H
+#define FILE_DCC_STATS_H
+
+#include <stdint.h>
+#include <avr/io.h>
+#include "../common/timer.h"
+#include "../common/rtc.h"
+
+/**
+ * Number of buckets of the histograms
+ */
+#define STATS_HALF_BUCKETS 8 // Half-bit durations
+#define STATS_PREAMBLE_BUCKETS 5 // Preamble lengths
+#define STATS_GAP_BUCKETS 5 // Gaps between packets
+
+/**
+ * Bucket of a half-bit duration d
+ *
+ * f converts microseconds to the unit of d, rounding down, and t is the
+ * quantization of d: a half-bit of T us is measured as f(T) up to f(T) + t.
+ * The buckets are: below 52 us, 52, 58, over 64, 90, 110, 200 and 1000 us or
+ * more. The NMRA limits for a receiver are 52-64 us for half a 1-bit, buckets
+ * 1 and 2, and at least 90 us for half a 0-bit, buckets 4 up to 7. The edges
+ * of these windows are widened by the quantization, so a half-bit in spec is
+ * never counted out of spec, whatever it's phase to the sampling. With the
+ * 10 us samples, this leaves nothing for bucket 3.
+ */
+#define stats_half_bucket(d, f, t) ((d) < f (52ULL) ? 0 \
+    : (d) < f (58ULL) + (t) ? 1 : (d) <= f (64ULL) + (t) ? 2 \
+    : (d) < f (90ULL) ? 3 : (d) < f (110ULL) ? 4 : (d) < f (200ULL) ? 5 \
+    : (d) < f (1000ULL) ? 6 : 7)
+
+/**
+ * Whether a half-bit in bucket b is out of spec: too short for half a 1-bit,
+ * or between half a 1 and half a 0
+ */
+#define stats_half_out_of_spec(b) ((b) == 0 || (b) == 3)
+
+/**
+ * Statistics since the last report
+ *
+ * Only written by the DCC receiver interrupt; read and reset by
+ * dcc_stats_report() with interrupts disabled. All counters saturate.
+ */
+extern uint16_t stats_half[STATS_HALF_BUCKETS];
+extern uint8_t stats_preamble[STATS_PREAMBLE_BUCKETS];
+extern uint8_t stats_gap[STATS_GAP_BUCKETS];
+extern uint16_t stats_out_of_spec; // Out-of-spec half-bits and preambles
+
+/**
+ * RTC time of the end of the last packet, lower 16 bits (TCNT1)
+ */
+extern uint16_t stats_packet_end;
+
+/**
+ * Reports since the end of the last packet, saturating at STATS_AGE_OLD
+ *
+ * TCNT1 wraps about every 6 seconds, so stats_packet_end is only used while
+ * this is below STATS_AGE_OLD: the packet ended less than 2 seconds ago. The
+ * report increases it every second.
+ */
+extern uint8_t stats_end_age;
+#define STATS_AGE_OLD 2
+#define STATS_AGE_NONE UINT8_MAX // No packet ended yet
+
+/**
+ * Record the duration of a half-bit, given as it's bucket
+ */
+static inline void stats_record_half (const uint8_t) __attribute__ ((always_inline));
+static inline void stats_record_half (const uint8_t bucket) {
+  if (stats_half[bucket] != UINT16_MAX) {
+    stats_half[bucket]++;
+  }
+  if (stats_half_out_of_spec (bucket) && stats_out_of_spec != UINT16_MAX) {
+    stats_out_of_spec++;
+  }
+}
+
+/**
+ * Record the start of a packet, after a preamble of 'bits' 1-bits
+ *
+ * Command stations should send at least 14 preamble bits. The buckets are:
+ * 10-11, 12-13, 14-15, 16-19 and 20 or more bits.
+ */
+static inline void stats_record_start (const uint8_t) __attribute__ ((always_inline));
+static inline void stats_record_start (const uint8_t bits) {
+  uint8_t bucket;
+  uint16_t gap;
+
+  bucket = (bits < 12) ? 0 : (bits < 14) ? 1 : (bits < 16) ? 2
+    : (bits < 20) ? 3 : 4;
+  if (stats_preamble[bucket] != UINT8_MAX) {
+    stats_preamble[bucket]++;
+  }
+  if (bits < 14 && stats_out_of_spec != UINT16_MAX) {
+    stats_out_of_spec++;
+  }
+
+  // Gap since the end of the last packet, in RTC ticks: below 2, 2-5, 5-10,
+  // 10-30 and 30 ms or more
+  if (stats_end_age == STATS_AGE_NONE) {
+    // First packet; no gap
+    return;
+  }
+  if (stats_end_age >= STATS_AGE_OLD) {
+    // Over a second ago; TCNT1 may have wrapped
+    bucket = 4;
+  } else {
+    gap = TCNT1 - stats_packet_end;
+    bucket = (gap < rtc_period (2 mseconds)) ? 0
+      : (gap < rtc_period (5 mseconds)) ? 1
+      : (gap < rtc_period (10 mseconds)) ? 2
+      : (gap < rtc_period (30 mseconds)) ? 3 : 4;
+  }
+  if (stats_gap[bucket] != UINT8_MAX) {
+    stats_gap[bucket]++;
+  }
+}
+
+/**
+ * Record the end of a packet
+ */
+static inline void stats_record_end () __attribute__ ((always_inline));
+static inline void stats_record_end () {
+  stats_packet_end = TCNT1;
+  stats_end_age = 0;
+}
+
+/**
+ * Start reporting the statistics
+ *
+ * Registers the software timer sending the "Signal statistics" every second.
+ */
+extern void dcc_stats_init ();
+
+#endif // ndef FILE_DCC_STATS_H
@@ -0,0 +1,247 @@
+/**
+ * DCC summary mode
+ *
+ * For monitoring a layout for a long time, every DCC packet is more than is
+ * needed. In summary mode, the packets are only counted, and every second a
+ * single "DCC summary" management frame is sent: the number of packets per
+ * group of classes, the number of bits set by the addresses seen, the number
+ * of bad packets and overflows, and the share of the time the bus carried
+ * packets other than idle packets. A whole chain of boards then fits on a
+ * slow link. Switching summary mode off goes back to sending every packet.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+#include "../common/global.h"
+#include "../common/comm_proto.h"
+#include "../common/timer.h"
+#include "../common/rtc.h"
+#include "dcc_receiver.h"
+#include "dcc_class.h"
+#include "dcc_validate.h"
+#include "dcc_summary.h"
+
+#ifdef DCC_WIRE_CAPTURE
+#error DCC_SUMMARY needs the packets as received, not in wire form
+#endif
+
+/**
+ * Groups of packet classes that are counted together, in the order of the
+ * summary frame
+ */
+#define GROUP_LOCO 0 // Multi-function decoders
+#define GROUP_ACC 1 // Accessory decoders
+#define GROUP_BROADCAST 2
+#define GROUP_RESET 3
+#define GROUP_IDLE 4
+#define GROUP_OTHER 5 // Service mode and reserved
+#define GROUPS 6
+
+/**
+ * Group of every packet class
+ */
+static const uint8_t class_group[DCC_CLASSES] PROGMEM = {
+  [DCC_CLASS_MF7] = GROUP_LOCO,
+  [DCC_CLASS_MF14] = GROUP_LOCO,
+  [DCC_CLASS_BASIC_ACC] = GROUP_ACC,
+  [DCC_CLASS_EXT_ACC] = GROUP_ACC,
+  [DCC_CLASS_BROADCAST] = GROUP_BROADCAST,
+  [DCC_CLASS_RESET] = GROUP_RESET,
+  [DCC_CLASS_IDLE] = GROUP_IDLE,
+  [DCC_CLASS_SERVICE] = GROUP_OTHER,
+  [DCC_CLASS_OTHER] = GROUP_OTHER
+};
+
+/**
+ * Nominal duration of the bits of a DCC packet in microseconds: 116 for a
+ * 1-bit, 200 for a 0-bit. The preamble is taken to be the minimal 14 bits.
+ */
+#define BIT1_US 116U
+#define BIT0_US 200U
+#define PREAMBLE_BITS 14
+
+/**
+ * Non-zero in summary mode
+ */
+#if DCC_SUMMARY == 2
+static uint8_t summary_on = 1;
+#else
+static uint8_t summary_on;
+#endif
+
+/**
+ * Counts since the last summary; the 8-bit ones saturate
+ */
+static uint8_t group_count[GROUPS];
+static uint8_t bad_count; // Packets failing the length or XOR check
+static uint8_t overflow_count; // Overflows of the DCC buffer
+static uint32_t busy_us; // Nominal duration of the packets other than idle
+
+/**
+ * Addresses seen, hashed into 64 bits
+ *
+ * Only the number of bits set is sent; the PC makes the linear counting
+ * estimate of the number of addresses from it, n * ln(n / zeros) with n = 64,
+ * which needs a logarithm the board can do without.
+ */
+static uint8_t address_seen[8];
+
+/**
+ * Add one to a saturating counter
+ */
+static inline void summary_count (uint8_t *) __attribute__ ((always_inline));
+static inline void summary_count (uint8_t *counter) {
+  if (*counter != UINT8_MAX) {
+    (*counter)++;
+  }
+}
+
+/**
+ * Clear the counts
+ */
+static void summary_clear () {
+  uint8_t i;
+
+  for (i = 0; i < GROUPS; i++) {
+    group_count[i] = 0;
+  }
+  for (i = 0; i < sizeof (address_seen); i++) {
+    address_seen[i] = 0;
+  }
+  bad_count = 0;
+  overflow_count = 0;
+  busy_us = 0;
+}
+
+/**
+ * Switch summary mode on or off
+ */
+void dcc_summary_set (const uint8_t on) {
+  summary_on = on;
+  summary_clear ();
+}
+
+/**
+ * Count a DCC packet of len bytes
+ */
+static void summary_packet (const uint8_t packet[], const uint8_t len) {
+  uint8_t class, i, check, ones, byte;
+  uint16_t address;
+
+  class = dcc_classify (packet, len, &address);
+  summary_count (&group_count[pgm_read_byte (&class_group[class])]);
+
+  if (class <= DCC_CLASS_EXT_ACC) {
+    // Accessory addresses are a separate range; the upper 6 bits of the
+    // product are the hash
+    if (class >= DCC_CLASS_BASIC_ACC) {
+      address |= 1 << 14;
+    }
+    i = (uint16_t) (address * 40503U) >> 10;
+    address_seen[i >> 3] |= _BV(i & 7);
+  }
+
+  // Check the length and the error detection byte, and count the 1-bits
+  check = 0;
+  ones = 0;
+  for (i = 0; i < len; i++) {
+    check ^= packet[i];
+    for (byte = packet[i]; byte; byte &= byte - 1) {
+      ones++;
+    }
+  }
+  if (check || len < DCC_MIN_LEN || len > DCC_MAX_LEN) {
+    summary_count (&bad_count);
+  }
+
+  if (class != DCC_CLASS_IDLE) {
+    // Preamble and end bit are 1-bits, the start bit of every byte a 0-bit
+    busy_us += (PREAMBLE_BITS + 1 + ones) * BIT1_US
+      + (len * 9 - ones) * BIT0_US;
+  }
+}
+
+/**
+ * Count the next DCC packet and the overflow status, in summary mode
+ */
+uint8_t dcc_summary_take (uint8_t packet[]) {
+  uint8_t len;
+
+  if (!summary_on) {
+    return 0;
+  }
+
+  if (dcc_overflow_status ()) {
+    summary_count (&overflow_count);
+  }
+  len = dcc_get_packet (packet);
+  if (len) {
+    summary_packet (packet, len);
+  }
+  return 1;
+}
+
+/**
+ * Send the "DCC summary" management frame and clear the counts, in summary
+ * mode.
+ *
+ * Run every second by a software timer.
+ */
+static int8_t dcc_summary_report () {
+  uint8_t i, seen, byte;
+  uint32_t busy;
+
+  if (!summary_on) {
+    return 0;
+  }
+
+  // Number of bits set in address_seen, for the estimate on the PC
+  seen = 0;
+  for (i = 0; i < sizeof (address_seen); i++) {
+    for (byte = address_seen[i]; byte; byte &= byte - 1) {
+      seen++;
+    }
+  }
+
+  comm_start_frame (MANAG_PROTO);
+  comm_send_byte (MANAG_DCC_OOB);
+  comm_send_byte (MANAG_DCC_SUMMARY);
+  for (i = 0; i < GROUPS; i++) {
+    comm_send_byte (group_count[i]);
+  }
+  comm_send_byte (seen);
+  comm_send_byte (bad_count);
+  comm_send_byte (overflow_count);
+  // Percentage of the second, rounded; the nominal durations can add up to
+  // a bit more than the second really had
+  busy = (busy_us + 5000) / 10000;
+  comm_send_byte ((busy > 100) ? 100 : busy);
+  comm_end_frame ();
+
+  summary_clear ();
+  return 1;
+}
+
+/**
+ * Start the summary job
+ */
+void dcc_summary_init () {
+  timer_add (dcc_summary_report, rtc_period (1 seconds), rtc_period (1 seconds));
+}
@@ -0,0 +1,57 @@
+/**
+ * DCC summary mode header file
+ *
+ * Defines the routines switching between sending every DCC packet and sending
+ * only a summary every second.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FILE_DCC_SUMMARY_H
+#define FILE_DCC_SUMMARY_H
+
+#include <stdint.h>
+
+/**
+ * Start the summary job
+ *
+ * Registers the software timer sending the "DCC summary" every second. With
+ * DCC_SUMMARY=2, the board starts in summary mode.
+ *
+ * Precondition: rtc_init() has been called.
+ */
+extern void dcc_summary_init ();
+
+/**
+ * Switch summary mode on (non-zero) or off
+ *
+ * The counts start from zero when it is switched on.
+ */
+extern void dcc_summary_set (const uint8_t on);
+
+/**
+ * In summary mode, take the next DCC packet and the overflow status from the
+ * receiver and count them.
+ *
+ * Should be called by the sender before it takes a packet itself; packet[]
+ * should be DCC_MAX_PACKET bytes big. Returns non-zero in summary mode, when
+ * the sender should leave the receiver alone.
+ */
+extern uint8_t dcc_summary_take (uint8_t packet[]);
+
+#endif // ndef FILE_DCC_SUMMARY_H
@@ -0,0 +1,86 @@
+/**
+ * DCC packet timestamps
+ *
+ * The DCC receiver stores the lower 16 bits of the RTC with every packet, at
+ * the moment the end bit arrives. The PC only knows when a frame arrives,
+ * after any time the frame spent waiting in the buffers, so only the board can
+ * tell the spacing of the packets on the bus.
+ *
+ * Since packets are only a few milliseconds apart, sending the difference
+ * with the previous packet takes mostly a single byte. The full time is
+ * recovered by assuming a packet is less than one RTC wrap (6 seconds) old
+ * when it is sent, so the differences are exact over any period.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include "../common/global.h"
+#include "../common/comm_proto.h"
+#include "../common/rtc.h"
+#include "dcc_receiver.h"
+#include "dccmon.h"
+#include "dcc_timestamp.h"
+
+/**
+ * Full RTC time of the previous timestamped packet
+ */
+static uint32_t last_time;
+
+/**
+ * Send a DCC packet in a "Timestamped DCC" frame.
+ */
+void dcc_send_stamped (const uint8_t packet[], const uint8_t len) {
+  uint8_t frame[MAX_FRAME_SIZE];
+  uint8_t i, n;
+  uint32_t time, delta;
+
+  time = dcc_packet_time ();
+  delta = time - last_time;
+  if (delta > STAMP_DELTA_MAX) {
+    delta = STAMP_DELTA_MAX;
+  }
+
+  // 0DDDDDDD, 10DDDDDD DDDDDDDD or 11DDDDDD DDDDDDDD DDDDDDDD
+  if (delta < 0x80) {
+    frame[0] = delta;
+    n = 1;
+  } else if (delta < 0x4000) {
+    frame[0] = 0x80 | (delta >> 8);
+    frame[1] = delta & 0xff;
+    n = 2;
+  } else {
+    frame[0] = 0xC0 | (delta >> 16);
+    frame[1] = (delta >> 8) & 0xff;
+    frame[2] = delta & 0xff;
+    n = 3;
+  }
+
+  if (len > MAX_FRAME_SIZE - n) {
+    // No room for the timestamp; the next packet gets the difference with the
+    // previous one that had it
+    comm_send_frame (DCC_PROTO, packet, len);
+    return;
+  }
+  last_time = time;
+
+  for (i = 0; i < len; i++) {
+    frame[n + i] = packet[i];
+  }
+  comm_send_frame (DCC_TS_PROTO, frame, n + len);
+}
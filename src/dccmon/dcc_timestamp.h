@@ -0,0 +1,42 @@
+/**
+ * DCC packet timestamps header file
+ *
+ * Defines the routine sending DCC packets with the time they were received.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_DCC_TIMESTAMP_H
+#define FILE_DCC_TIMESTAMP_H
+
+#include <stdint.h>
+
+/**
+ * Largest time difference that can be sent, in RTC ticks: 22 bits
+ */
+#define STAMP_DELTA_MAX 0x3FFFFFUL
+
+/**
+ * Send DCC packet 'packet' of 'len' bytes, the packet last returned by
+ * dcc_get_packet(), in a "Timestamped DCC" frame.
+ *
+ * The frame starts with the time since the previous timestamped packet.
+ * Packets too long for a frame with a timestamp are sent in a plain DCC frame.
+ */
+extern void dcc_send_stamped (const uint8_t packet[], const uint8_t len);
+
+#endif // ndef FILE_DCC_TIMESTAMP_H
@@ -0,0 +1,103 @@
+/**
+ * DCC packet validation
+ *
+ * The DCC receiver checks the error detection byte and the length of every
+ * packet as it receives it. Depending on DCC_VALIDATE, a bad packet is still
+ * sent to the PC followed by a "Bad DCC packet" management frame (1), dropped
+ * (2), or dropped and counted per error class (3). The counts are sent to the
+ * PC every second in which a packet was dropped.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <avr/interrupt.h>
+#include "../common/global.h"
+#include "../common/comm_proto.h"
+#include "../common/timer.h"
+#include "../common/rtc.h"
+#include "dcc_receiver.h"
+#include "dcc_validate.h"
+
+#if DCC_VALIDATE == 1
+/**
+ * Send the "Bad DCC packet" management frame when the packet last returned by
+ * dcc_get_packet() failed validation.
+ */
+int8_t dcc_validate_flag () {
+  uint8_t error;
+
+  error = dcc_packet_error ();
+  if (!error) {
+    return 0;
+  }
+
+  comm_start_frame (MANAG_PROTO);
+  comm_send_byte (MANAG_DCC_OOB);
+  comm_send_byte (MANAG_DCC_VALIDATE);
+  comm_send_byte (0); // The previous packet was bad
+  comm_send_byte (error);
+  comm_end_frame ();
+  return 1;
+}
+#endif
+
+#if DCC_VALIDATE == 3
+uint8_t validate_errors[DCC_ERR_LONG];
+
+/**
+ * Send the "Dropped bad DCC packets" management frame, if packets were
+ * dropped, and reset the counters.
+ *
+ * Run every second by a software timer.
+ */
+static int8_t dcc_validate_report () {
+  uint8_t errors[DCC_ERR_LONG];
+  uint8_t i, dropped;
+
+  cli(); // Start of critical section
+  dropped = 0;
+  for (i = 0; i < DCC_ERR_LONG; i++) {
+    errors[i] = validate_errors[i];
+    dropped |= errors[i];
+    validate_errors[i] = 0;
+  }
+  sei(); // End of critical section
+
+  if (!dropped) {
+    return 0;
+  }
+
+  comm_start_frame (MANAG_PROTO);
+  comm_send_byte (MANAG_DCC_OOB);
+  comm_send_byte (MANAG_DCC_VALIDATE);
+  comm_send_byte (1); // Summary of dropped packets
+  for (i = 0; i < DCC_ERR_LONG; i++) {
+    comm_send_byte (errors[i]);
+  }
+  comm_end_frame ();
+  return 1;
+}
+
+/**
+ * Start reporting the dropped packets
+ */
+void dcc_validate_init () {
+  timer_add (dcc_validate_report, rtc_period (1 seconds), rtc_period (1 seconds));
+}
+#endif
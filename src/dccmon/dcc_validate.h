@@ -0,0 +1,90 @@
+/**
+ * DCC packet validation header file
+ *
+ * Defines the checks the DCC receiver does on every packet, the counters of
+ * the packets it dropped and the routines reporting them.
+ *
+ * This file is part of DCC Monitor.
+ *
+ * Copyright 2008 Peter Lebbing <peter@digitalbrains.com>
+ *
+ * DCC Monitor is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * DCC Monitor is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with DCC Monitor.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef FILE_DCC_VALIDATE_H
+#define FILE_DCC_VALIDATE_H
+
+#include <stdint.h>
+
+/**
+ * Length limits of a DCC packet, including the error detection byte (NMRA
+ * S-9.2 and S-9.2.1)
+ */
+#define DCC_MIN_LEN 3
+#define DCC_MAX_LEN 6
+
+/**
+ * Classes of errors found in a packet
+ */
+#define DCC_ERR_CHECKSUM 1 // The XOR of all bytes is not zero
+#define DCC_ERR_SHORT 2 // Fewer than DCC_MIN_LEN bytes
+#define DCC_ERR_LONG 3 // More than DCC_MAX_LEN bytes
+
+/**
+ * With DCC_VALIDATE=1, the error class of a packet is kept in the bits of
+ * it's length byte in the DCC buffer from this bit on; lengths stay below 32.
+ */
+#define DCC_ERR_SHIFT 5
+
+#if DCC_VALIDATE == 1
+/**
+ * Send the "Bad DCC packet" management frame when the packet last returned by
+ * dcc_get_packet() failed validation.
+ *
+ * Should be called right after sending that packet to the PC.
+ * Returns non-zero when a frame was sent.
+ */
+extern int8_t dcc_validate_flag ();
+#endif
+
+#if DCC_VALIDATE == 3
+/**
+ * Dropped packets per error class since the last report
+ *
+ * Only written by the DCC receiver interrupt; read and reset by the report
+ * with interrupts disabled. The counters saturate at 255.
+ */
+extern uint8_t validate_errors[DCC_ERR_LONG];
+
+/**
+ * Count a dropped packet with error class 'error'
+ */
+static inline void validate_count (const uint8_t) __attribute__ ((always_inline));
+static inline void validate_count (const uint8_t error) {
+  if (validate_errors[error - 1] != UINT8_MAX) {
+    validate_errors[error - 1]++;
+  }
+}
+
+/**
+ * Start reporting the dropped packets
+ *
+ * Registers the software timer sending the "Dropped bad DCC packets" summary
+ * every second.
+ *
+ * Precondition: rtc_init() has been called.
+ */
+extern void dcc_validate_init ();
+#endif
+
+#endif // ndef FILE_DCC_VALIDATE_H
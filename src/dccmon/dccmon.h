@@ -25,17 +25,58 @@
 #ifndef FILE_DCCMON_H
 #define FILE_DCCMON_H
 
+/**
+ * DCC_PACKET_TIME: the receiver stores the time of the end bit with every
+ * packet, see dcc_packet_time()
+ */
+#if defined(DCC_TIMESTAMP) || defined(DCC_IDLE_ELISION)
+#define DCC_PACKET_TIME
+#endif
+
 /**
  * DCC buffer size
- * Maximum of 256 (pointers are 8-bit)
- * A power of 2 results in more optimal code
+ * Must be a power of 2, maximum of 256 (pointers are 8-bit)
  * It should probably be able to hold at least 2 DCC messages plus 2 length
  * bytes. That way another frame can be received while the first is transmitted,
  * plus some leeway for any delays.
  */
+#if defined(DCC_WIRE_CAPTURE) || defined(DCC_PACKET_TIME)
+// A packet takes 3 bytes more in wire form, and 2 more with it's time
+#define DCC_BUFSIZE 32
+#else
 #define DCC_BUFSIZE 16
+#endif
+
+/**
+ * Largest DCC packet that fits in the buffer: one position holds the length
+ * and one is always kept free.
+ *
+ * With DCC_WIRE_CAPTURE, this is the largest frame in wire form. With
+ * DCC_PACKET_TIME, two more positions hold the time.
+ */
+#ifdef DCC_PACKET_TIME
+#define DCC_MAX_PACKET (DCC_BUFSIZE - 4)
+#else
+#define DCC_MAX_PACKET (DCC_BUFSIZE - 2)
+#endif
 
 #define DCC_PROTO 1 // DCC protocol number for Communication protocol
+#define DCC_TS_PROTO 3 // Timestamped DCC protocol number
+#define DCC_CH1_PROTO 4 // DCC protocol number for the second DCC input
+
+/**
+ * Command protocol commands of the DCC monitor
+ */
+// Switch Accessory Decoder filter; argument 0: off, 1: on
+#define CMD_DCC_FILTER (CMD_MONITOR + 0)
+// Clear the filter rules; argument 0: drop, 1: send packets matching no rule
+#define CMD_DCC_RULES_CLEAR (CMD_MONITOR + 1)
+// Set a filter rule; arguments: rule, classes, action, low and high address
+#define CMD_DCC_RULE (CMD_MONITOR + 2)
+// Send the filter rule hits
+#define CMD_DCC_RULE_HITS (CMD_MONITOR + 3)
+// Switch summary mode; argument 0: send every packet, 1: only summaries
+#define CMD_DCC_SUMMARY (CMD_MONITOR + 4)
 
 // DCC input port
 #define DCC_INPUT_PORT PIND
@@ -43,5 +84,18 @@
 #define DCC_INPUT_DDR DDRD
 // DCC input pin
 #define DCC_INPUT_PIN 3
+// Second DCC input pin, on the same port, with DCC_DUAL_CHANNEL
+#define DCC_INPUT_PIN2 2
+
+/**
+ * Number of DCC inputs
+ *
+ * Every input has it's own buffer of DCC_BUFSIZE bytes.
+ */
+#ifdef DCC_DUAL_CHANNEL
+#define DCC_CHANNELS 2
+#else
+#define DCC_CHANNELS 1
+#endif
 
 #endif // ndef FILE_DCCMON_H
@@ -46,9 +46,7 @@ int8_t rs_send () {
 
   if (rs_overflow_status()) {
     // Overflow occured
-    comm_start_frame (MANAG_PROTO); // Management protocol
-    comm_send_byte (MANAG_BUS_OVF); // Overflow on monitored bus
-    comm_end_frame ();
+    comm_send_manag_code (MANAG_BUS_OVF); // Overflow on monitored bus
     retval = 1;
   }
   
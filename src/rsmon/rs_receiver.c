@@ -9,10 +9,7 @@
  * INT0: Address pulses from the command station
  * INT1/PD3: Data sent by responders
  * TIMER0: times data reception from responder
- * TIMER1 is used as a "real time clock"
- *
- * The TIMER1_OVF interrupt is defined here; should it be needed for other
- * purposes as well, some method to integrate the purposes has to be written.
+ * TIMER1 is used as a "real time clock" through the routines in rtc.c
  * 
  * This file is part of DCC Monitor.
  *
@@ -39,6 +36,8 @@
 #include "rs_receiver.h"
 #include "../common/global.h"
 #include "../common/timer.h"
+#include "../common/ring.h"
+#include "../common/rtc.h"
 
 /** 
  * Timer definitions for receiving bytes from the RS-bus responders.
@@ -74,6 +73,8 @@
  *
  * overflow is non-zero when the buffer overflowed (set by interrupt routine,
  * cleared by rs_overflow_status() ).
+ *
+ * The pointer arithmetic is that of ring.h.
  */
 static struct {
   volatile uint8_t status[RS_BUFSIZE];
@@ -81,8 +82,18 @@ static struct {
   volatile uint8_t data[RS_BUFSIZE];
   volatile uint8_t head, tail;
   volatile uint8_t overflow;
+  RING_HWM_MEMBER
 } rs_buf;
 
+/**
+ * Push out the receptions in rs_buf up to (not including) pointer new_head
+ */
+#define rs_buf_commit(new_head) do { \
+  rs_buf.head = (new_head); \
+  ring_hwm_ (ring_hwm_ptr (rs_buf), (new_head), rs_buf.tail, \
+      ring_size_mask (RS_BUFSIZE)); \
+} while (0)
+
 /**
  * Sample counter for supersampling of received RS-bus data
  *
@@ -113,7 +124,6 @@ static uint8_t rs_state;
 #define RS_STARTBIT 2 // We expect a startbit
 #define RS_IN_BYTE 3 // We expect another bit for the received byte
 #define RS_STOPBIT 4 // We expect a stopbit
-#define RS_TIMER_OVF 5 // RS_ADDR, but real time clock has overflowed
 
 /**
  * Initialise RS-bus monitoring process.
@@ -153,7 +163,6 @@ void rs_init() {
   
   GICR |= _BV(INT0); // Enable INT0
   TIMSK |= _BV(OCIE0); // Enable TIMER0 Compare Match interrupt
-  TIMSK |= _BV(TOIE1); // Enable TIMER1 Overflow Interrupt
 }
 
 /**
@@ -226,26 +235,18 @@ uint8_t rs_get_data () {
 
   temp_tail = rs_buf.tail;
   data = rs_buf.data[temp_tail];
-  circ_buf_incr_ptr (&temp_tail, RS_BUFSIZE);
-  rs_buf.tail = temp_tail;
+  rs_buf.tail = ring_size_next (temp_tail, RS_BUFSIZE);
   return data;
 }
 
+#ifdef RING_HWM
 /**
- * This routine gets called when TIMER1 overflows; if we are in a state where
- * we expect address pulses, we need to keep track of the overflows to prevent
- * misinterpreting the elapsed time since the last pulse.
+ * Read and reset the high-water mark of the RS-bus buffer
  */
-ISR(TIMER1_OVF_vect) {
-  if (rs_state == RS_ADDR) {
-    // Change to state RS_TIMER_OVF to keep track of overflow
-    rs_state = RS_TIMER_OVF;
-  } else if (rs_state == RS_TIMER_OVF) {
-    // Timer overflowed twice; this means we haven't seen address pulses all
-    // that time, so the bus is idle.
-    rs_state = RS_IDLE;
-  }
+uint8_t monitor_hwm () {
+  return ring_size_hwm_take (rs_buf, RS_BUFSIZE);
 }
+#endif
 
 /**
  * This interrupt gets called when the INT0 pin has a falling edge; this 
@@ -254,12 +255,12 @@ ISR(TIMER1_OVF_vect) {
  * INT1 is enabled again to allow a single databyte to be clocked in.
  */
 ISR(INT0_vect) {
-  static uint16_t last_pulse_time; // "Real" time of last address pulse
+  static uint32_t last_pulse_time; // "Real" time of last address pulse
   static uint8_t reported_addr_err; // Did we report an addressing error yet?
-  uint16_t now, passed;
+  uint32_t now, passed;
 
   // Get "real" time (done early for accuracy)
-  now = TCNT1;
+  now = rtc_now_unlocked ();
 
   // Enable INT1 to clock in one databyte
   GIFR = _BV(INTF1); // Clear INT1 interrupt flag
@@ -272,11 +273,6 @@ ISR(INT0_vect) {
     last_pulse_time = now; // Store this pulse time
     return;
 
-  } else if (rs_state == RS_TIMER_OVF) {
-    // We now have a pulse; we can discard the fact the timer overflowed *once*,
-    // and use the fact that unsigned integer arithmetic wraps round
-    rs_state = RS_ADDR;
-
   } else if (rs_state != RS_ADDR) {
     // We were receiving a byte, but the command station cut it off. Abort
     // receival and continue in address pulse state
@@ -285,7 +281,8 @@ ISR(INT0_vect) {
     TIFR = _BV(OCF0); // Clear any pending TIMER0 interrupt
   }
 
-  // Difference between last pulse time and now
+  // Difference between last pulse time and now. The 32-bit time doesn't
+  // overflow between pulses, so a long idle bus simply resets the address below.
   passed = now - last_pulse_time;
 
   // Check if 5 ms has passed
@@ -307,14 +304,19 @@ ISR(INT0_vect) {
       
       if (!reported_addr_err) {
         // Report
-        uint8_t temp_head;
+        uint8_t temp_head, temp_new_head;
 
-        reported_addr_err = 1; // Report just this time
         temp_head = rs_buf.head;
-        rs_buf.status[temp_head] = RS_ADDR_ERR;
-        // Note: rs_buf.addr and rs_buf.data are don't-care
-        circ_buf_incr_ptr (&temp_head, RS_BUFSIZE);
-        rs_buf.head = temp_head;
+        temp_new_head = ring_size_next (temp_head, RS_BUFSIZE);
+        if (temp_new_head == rs_buf.tail) {
+          // Overflow; try to report again on the next pulse
+          rs_buf.overflow = 1;
+        } else {
+          reported_addr_err = 1; // Report just this time
+          rs_buf.status[temp_head] = RS_ADDR_ERR;
+          // Note: rs_buf.addr and rs_buf.data are don't-care
+          rs_buf_commit (temp_new_head);
+        }
       }
 
     } else {
@@ -557,8 +559,7 @@ ISR(TIMER0_COMP_vect) {
       temp_head = rs_buf.head;
 
       // Increase and check head pointer
-      temp_new_head = temp_head;
-      circ_buf_incr_ptr (&temp_new_head, RS_BUFSIZE);
+      temp_new_head = ring_size_next (temp_head, RS_BUFSIZE);
       if (temp_new_head == rs_buf.tail) {
         // Overflow
         rs_buf.overflow = 1;
@@ -577,7 +578,7 @@ ISR(TIMER0_COMP_vect) {
         }
         
         // Push out received status, address and byte
-        rs_buf.head = temp_new_head;
+        rs_buf_commit (temp_new_head);
       }
       
       /* Back to address pulse state
@@ -3,9 +3,8 @@
  *
  * Defines the routines for handling the reception of RS-bus data
  *
- * Note: the RS-bus reception routines define the TIMER1_OVF interrupt handler.
- * Should it be needed for other purposes as well, some method to integrate the
- * purposes has to be written.
+ * Note: the RS-bus reception routines use the 32-bit "real time" of rtc.c to
+ * time the address pulses.
  *
  * This file is part of DCC Monitor.
  *
@@ -30,8 +30,7 @@
  * Denotes the total number of RS datapackets that can be held. A datapacket
  * consists of status, address and nibble data.
  *
- * Maximum of 256 (8-bit pointers)
- * Powers of 2 result in more optimal code.
+ * Must be a power of 2, maximum of 256 (8-bit pointers)
  */
 #define RS_BUFSIZE 16
 